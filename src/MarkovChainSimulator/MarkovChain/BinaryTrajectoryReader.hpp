@@ -0,0 +1,119 @@
+#ifndef BINARYTRAJECTORYREADER_H
+#define BINARYTRAJECTORYREADER_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+//Reads the columnar binary trajectories written by SerialiserBinary. Needs only the standard library,
+//so it can be compiled into programs that do not use the simulator.
+//
+//Layout, with every number in native byte order:
+//  header: "MCTB", uint32 version (1), uint32 value size (8 for double, 4 for float), uint64 row count,
+//          uint32 column count, then per column a uint32 name length and the name. Column 0 is "t".
+//  blocks: uint32 row count, then each column's values for those rows, column after column.
+//The header's row count is 0 if the writer did not finish; the blocks written so far can still be read.
+class BinaryTrajectoryReader
+{
+private:
+    std::ifstream mInputfile;
+    bool mGood = false;
+    uint32_t mValueSize = 0;
+    uint64_t mRows = 0;
+    std::vector<std::string> mNames;
+    std::vector<float> mSingleColumn;
+
+    template <typename T>
+    bool read(T &value)
+    {
+        return (bool(mInputfile.read(reinterpret_cast<char *>(&value), sizeof(T))));
+    }
+
+public:
+    BinaryTrajectoryReader(std::string filename)
+    {
+        mInputfile.open(filename, std::ios::binary);
+        char magic[4];
+        uint32_t version = 0;
+        uint32_t columns = 0;
+        if (!mInputfile.read(magic, 4) || std::string(magic, 4) != "MCTB" || !read(version) || version != 1 ||
+            !read(mValueSize) || (mValueSize != sizeof(double) && mValueSize != sizeof(float)) || !read(mRows) || !read(columns))
+            return;
+        for (uint32_t c = 0; c < columns; c++)
+        {
+            uint32_t length = 0;
+            if (!read(length))
+                return;
+            std::string name(length, ' ');
+            if (!mInputfile.read(&name[0], length))
+                return;
+            mNames.push_back(name);
+        }
+        mGood = true;
+    }
+
+    //False if the file could not be opened or is not a binary trajectory.
+    bool good() const
+    {
+        return (mGood);
+    }
+
+    const std::vector<std::string> &getNames() const
+    {
+        return (mNames);
+    }
+
+    //The number of rows recorded in the header, or 0 for a file that was not finished.
+    uint64_t getRowCount() const
+    {
+        return (mRows);
+    }
+
+    //Replaces columns with the next block, one vector per name. Returns false at the end of the file.
+    bool readBlock(std::vector<std::vector<double>> &columns)
+    {
+        uint32_t rows = 0;
+        if (!mGood || !read(rows))
+            return (false);
+        columns.resize(mNames.size());
+        for (std::vector<double> &column : columns)
+        {
+            column.resize(rows);
+            if (mValueSize == sizeof(double))
+            {
+                if (!mInputfile.read(reinterpret_cast<char *>(column.data()), rows * sizeof(double)))
+                    return (false);
+                continue;
+            }
+            mSingleColumn.resize(rows);
+            if (!mInputfile.read(reinterpret_cast<char *>(mSingleColumn.data()), rows * sizeof(float)))
+                return (false);
+            for (uint32_t r = 0; r < rows; r++)
+                column[r] = mSingleColumn[r];
+        }
+        return (true);
+    }
+
+    //Every remaining row, by column name.
+    std::map<std::string, std::vector<double>> readAll()
+    {
+        std::vector<std::vector<double>> columns(mNames.size());
+        for (std::vector<double> &column : columns)
+            column.reserve(mRows);
+        std::vector<std::vector<double>> block;
+        while (readBlock(block))
+        {
+            for (size_t c = 0; c < columns.size(); c++)
+                columns[c].insert(columns[c].end(), block[c].begin(), block[c].end());
+        }
+
+        std::map<std::string, std::vector<double>> results;
+        for (size_t c = 0; c < columns.size(); c++)
+            results[mNames[c]].swap(columns[c]);
+        return (results);
+    }
+};
+
+#endif
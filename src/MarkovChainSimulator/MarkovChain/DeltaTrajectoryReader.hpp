@@ -0,0 +1,161 @@
+#ifndef DELTATRAJECTORYREADER_H
+#define DELTATRAJECTORYREADER_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+//Reads the integer trajectories written by SerialiserDelta. Needs only the standard library and zlib,
+//so it can be compiled into programs that do not use the simulator.
+//
+//Layout, with every number in native byte order:
+//  header: "MCTD", uint32 version (1), uint32 flags (1 if blocks are deflated with zlib), uint64 row count,
+//          uint32 column count, then per column a uint32 name length and the name. Column 0 is "t".
+//  blocks: uint32 row count, uint32 stored size, and for deflated blocks the uint32 size once inflated,
+//          then the stored bytes. Once inflated, a block holds its times as doubles, then for each other
+//          column the change in every row from the one before (from zero for the first), as zigzag varints.
+//The header's row count is 0 if the writer did not finish; the blocks written so far can still be read.
+class DeltaTrajectoryReader
+{
+private:
+    std::ifstream mInputfile;
+    bool mGood = false;
+    bool mCompressed = false;
+    uint64_t mRows = 0;
+    std::vector<std::string> mNames;
+    std::vector<unsigned char> mStored;
+    std::vector<unsigned char> mEncoded;
+
+    template <typename T>
+    bool read(T &value)
+    {
+        return (bool(mInputfile.read(reinterpret_cast<char *>(&value), sizeof(T))));
+    }
+
+    static bool readVarint(const unsigned char *&position, const unsigned char *end, int64_t &value)
+    {
+        uint64_t zigzag = 0;
+        for (int shift = 0; position < end && shift < 64; shift += 7)
+        {
+            unsigned char byte = *position++;
+            zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+                return (true);
+            }
+        }
+        return (false);
+    }
+
+public:
+    DeltaTrajectoryReader(std::string filename)
+    {
+        mInputfile.open(filename, std::ios::binary);
+        char magic[4];
+        uint32_t version = 0;
+        uint32_t flags = 0;
+        uint32_t columns = 0;
+        if (!mInputfile.read(magic, 4) || std::string(magic, 4) != "MCTD" || !read(version) || version != 1 ||
+            !read(flags) || !read(mRows) || !read(columns) || columns == 0)
+            return;
+        mCompressed = (flags & 1) != 0;
+        for (uint32_t c = 0; c < columns; c++)
+        {
+            uint32_t length = 0;
+            if (!read(length))
+                return;
+            std::string name(length, ' ');
+            if (!mInputfile.read(&name[0], length))
+                return;
+            mNames.push_back(name);
+        }
+        mGood = true;
+    }
+
+    //False if the file could not be opened or is not a delta-encoded trajectory.
+    bool good() const
+    {
+        return (mGood);
+    }
+
+    const std::vector<std::string> &getNames() const
+    {
+        return (mNames);
+    }
+
+    //The number of rows recorded in the header, or 0 for a file that was not finished.
+    uint64_t getRowCount() const
+    {
+        return (mRows);
+    }
+
+    //Replaces columns with the next block, one vector per name. Returns false at the end of the file.
+    bool readBlock(std::vector<std::vector<double>> &columns)
+    {
+        uint32_t rows = 0;
+        uint32_t stored_size = 0;
+        uint32_t encoded_size = 0;
+        if (!mGood || !read(rows) || !read(stored_size) || (mCompressed && !read(encoded_size)))
+            return (false);
+        mStored.resize(stored_size);
+        if (!mInputfile.read(reinterpret_cast<char *>(mStored.data()), stored_size))
+            return (false);
+        if (mCompressed)
+        {
+            uLongf inflated_size = encoded_size;
+            mEncoded.resize(encoded_size);
+            if (uncompress(mEncoded.data(), &inflated_size, mStored.data(), stored_size) != Z_OK || inflated_size != encoded_size)
+                return (false);
+        }
+        else
+            mEncoded.swap(mStored);
+
+        if (mEncoded.size() < rows * sizeof(double))
+            return (false);
+        columns.resize(mNames.size());
+        columns[0].resize(rows);
+        std::memcpy(columns[0].data(), mEncoded.data(), rows * sizeof(double));
+        const unsigned char *position = mEncoded.data() + rows * sizeof(double);
+        const unsigned char *end = mEncoded.data() + mEncoded.size();
+        for (size_t c = 1; c < columns.size(); c++)
+        {
+            columns[c].resize(rows);
+            int64_t value = 0;
+            for (uint32_t r = 0; r < rows; r++)
+            {
+                int64_t change = 0;
+                if (!readVarint(position, end, change))
+                    return (false);
+                value += change;
+                columns[c][r] = value;
+            }
+        }
+        return (true);
+    }
+
+    //Every remaining row, by column name.
+    std::map<std::string, std::vector<double>> readAll()
+    {
+        std::vector<std::vector<double>> columns(mNames.size());
+        for (std::vector<double> &column : columns)
+            column.reserve(mRows);
+        std::vector<std::vector<double>> block;
+        while (readBlock(block))
+        {
+            for (size_t c = 0; c < columns.size(); c++)
+                columns[c].insert(columns[c].end(), block[c].begin(), block[c].end());
+        }
+
+        std::map<std::string, std::vector<double>> results;
+        for (size_t c = 0; c < columns.size(); c++)
+            results[mNames[c]].swap(columns[c]);
+        return (results);
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "EnsembleSummary.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+QuantileEstimate::QuantileEstimate(double p) : mP(p) {}
+
+double QuantileEstimate::parabolic(int i, double d) const
+{
+    return (mHeights[i] + d / (mPositions[i + 1] - mPositions[i - 1]) *
+                              ((mPositions[i] - mPositions[i - 1] + d) * (mHeights[i + 1] - mHeights[i]) / (mPositions[i + 1] - mPositions[i]) +
+                               (mPositions[i + 1] - mPositions[i] - d) * (mHeights[i] - mHeights[i - 1]) / (mPositions[i] - mPositions[i - 1])));
+}
+
+double QuantileEstimate::linear(int i, double d) const
+{
+    int j = i + (int)d;
+    return (mHeights[i] + d * (mHeights[j] - mHeights[i]) / (mPositions[j] - mPositions[i]));
+}
+
+void QuantileEstimate::add(double x)
+{
+    if (mCount < 5)
+    {
+        mHeights[mCount++] = x;
+        if (mCount == 5)
+        {
+            std::sort(mHeights, mHeights + 5);
+            for (int i = 0; i < 5; i++)
+                mPositions[i] = i + 1;
+            mDesired[0] = 1;
+            mDesired[1] = 1 + 2 * mP;
+            mDesired[2] = 1 + 4 * mP;
+            mDesired[3] = 3 + 2 * mP;
+            mDesired[4] = 5;
+        }
+        return;
+    }
+
+    int k;
+    if (x < mHeights[0])
+    {
+        mHeights[0] = x;
+        k = 0;
+    }
+    else if (x >= mHeights[4])
+    {
+        mHeights[4] = x;
+        k = 3;
+    }
+    else
+    {
+        k = 0;
+        while (x >= mHeights[k + 1])
+            k++;
+    }
+
+    for (int i = k + 1; i < 5; i++)
+        mPositions[i] += 1;
+    const double increments[5] = {0, mP / 2, mP, (1 + mP) / 2, 1};
+    for (int i = 0; i < 5; i++)
+        mDesired[i] += increments[i];
+
+    for (int i = 1; i < 4; i++)
+    {
+        double d = mDesired[i] - mPositions[i];
+        if ((d >= 1 && mPositions[i + 1] - mPositions[i] > 1) || (d <= -1 && mPositions[i - 1] - mPositions[i] < -1))
+        {
+            d = d > 0 ? 1 : -1;
+            double height = parabolic(i, d);
+            if (mHeights[i - 1] < height && height < mHeights[i + 1])
+                mHeights[i] = height;
+            else
+                mHeights[i] = linear(i, d);
+            mPositions[i] += d;
+        }
+    }
+    mCount++;
+}
+
+double QuantileEstimate::get() const
+{
+    if (mCount == 0)
+        return (std::numeric_limits<double>::quiet_NaN());
+    if (mCount >= 5)
+        return (mHeights[2]);
+
+    std::vector<double> sorted(mHeights, mHeights + mCount);
+    std::sort(sorted.begin(), sorted.end());
+    return (sorted[(int)std::floor(mP * (mCount - 1) + 0.5)]);
+}
+
+EnsembleSummary::EnsembleSummary(std::vector<double> times, std::vector<double> probabilities) : mTimes(times), mProbabilities(probabilities), mCounts(times.size(), 0) {}
+
+void EnsembleSummary::add(const std::map<std::string, std::vector<double>> &columns)
+{
+    if (mColumns.empty())
+    {
+        for (auto &column : columns)
+        {
+            if (column.first != "t")
+                mColumns.push_back(column.first);
+        }
+        Cell cell;
+        for (double p : mProbabilities)
+            cell.quantiles.push_back(QuantileEstimate(p));
+        mCells.assign(mTimes.size(), std::vector<Cell>(mColumns.size(), cell));
+    }
+
+    std::map<std::string, std::vector<double>>::const_iterator times = columns.find("t");
+    if (times == columns.end())
+        return;
+    int rows = std::min(times->second.size(), mTimes.size());
+
+    for (int row = 0; row < rows; row++)
+        mCounts[row]++;
+
+    for (size_t c = 0; c < mColumns.size(); c++)
+    {
+        std::map<std::string, std::vector<double>>::const_iterator values = columns.find(mColumns[c]);
+        if (values == columns.end())
+            continue;
+        for (int row = 0; row < rows; row++)
+        {
+            double x = values->second[row];
+            Cell &cell = mCells[row][c];
+            double delta = x - cell.mean;
+            cell.mean += delta / mCounts[row];
+            cell.m2 += delta * (x - cell.mean);
+            for (QuantileEstimate &quantile : cell.quantiles)
+                quantile.add(x);
+        }
+    }
+}
+
+const std::vector<double> &EnsembleSummary::getTimes() const
+{
+    return (mTimes);
+}
+
+const std::vector<double> &EnsembleSummary::getProbabilities() const
+{
+    return (mProbabilities);
+}
+
+const std::vector<std::string> &EnsembleSummary::getColumns() const
+{
+    return (mColumns);
+}
+
+int EnsembleSummary::getCount(int row) const
+{
+    return (mCounts[row]);
+}
+
+double EnsembleSummary::getMean(int row, int column) const
+{
+    if (mCounts[row] == 0)
+        return (std::numeric_limits<double>::quiet_NaN());
+    return (mCells[row][column].mean);
+}
+
+double EnsembleSummary::getVariance(int row, int column) const
+{
+    if (mCounts[row] < 2)
+        return (std::numeric_limits<double>::quiet_NaN());
+    return (mCells[row][column].m2 / (mCounts[row] - 1));
+}
+
+double EnsembleSummary::getQuantile(int row, int column, int probability) const
+{
+    return (mCells[row][column].quantiles[probability].get());
+}
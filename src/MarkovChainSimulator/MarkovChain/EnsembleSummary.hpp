@@ -0,0 +1,60 @@
+#ifndef ENSEMBLESUMMARY_H
+#define ENSEMBLESUMMARY_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+//P-square estimate of a single quantile (Jain & Chlamtac, 1985). Five markers, no stored observations.
+class QuantileEstimate
+{
+private:
+    double mP;
+    double mHeights[5];
+    double mPositions[5];
+    double mDesired[5];
+    int mCount = 0;
+
+    double parabolic(int i, double d) const;
+    double linear(int i, double d) const;
+
+public:
+    QuantileEstimate(double p = 0.5);
+    void add(double x);
+    double get() const;
+};
+
+//Running mean and variance (Welford) plus quantile estimates of every state at every output time,
+//over an ensemble of realisations. Memory is O(times x states) whatever the number of realisations.
+class EnsembleSummary
+{
+private:
+    struct Cell
+    {
+        double mean = 0;
+        double m2 = 0;
+        std::vector<QuantileEstimate> quantiles;
+    };
+
+    std::vector<double> mTimes;
+    std::vector<double> mProbabilities;
+    std::vector<std::string> mColumns;
+    std::vector<std::vector<Cell>> mCells;
+    std::vector<int> mCounts;
+
+public:
+    EnsembleSummary(std::vector<double> times, std::vector<double> probabilities);
+
+    //Folds in one realisation sampled on the output times, as produced by SerialiserPredefinedTimesMemory.
+    void add(const std::map<std::string, std::vector<double>> &columns);
+
+    const std::vector<double> &getTimes() const;
+    const std::vector<double> &getProbabilities() const;
+    const std::vector<std::string> &getColumns() const;
+    int getCount(int row) const;
+    double getMean(int row, int column) const;
+    double getVariance(int row, int column) const;
+    double getQuantile(int row, int column, int probability) const;
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "EventLog.hpp"
+
+namespace
+{
+const char EVENT_LOG_MAGIC[] = {'M', 'C', 'E', 'L'};
+const uint32_t EVENT_LOG_VERSION = 1;
+const std::streamoff EVENT_RECORD_SIZE = sizeof(double) + sizeof(int32_t);
+}
+
+EventLogWriter::EventLogWriter(std::string filename, int keyframe_interval) : mKeyframeInterval(std::max(keyframe_interval, 1))
+{
+    mOutputfile.open(filename, std::ios::binary);
+}
+
+
+void EventLogWriter::writeRecord(double t, int transition)
+{
+    const int32_t index = transition;
+    mOutputfile.write(reinterpret_cast<const char *>(&t), sizeof(t));
+    mOutputfile.write(reinterpret_cast<const char *>(&index), sizeof(index));
+}
+
+
+void EventLogWriter::writeStates(double t, int kind, const double *values)
+{
+    writeRecord(t, kind);
+    mOutputfile.write(reinterpret_cast<const char *>(values), mStates * sizeof(double));
+}
+
+
+void EventLogWriter::start(const state_index &schema, double t, const double *values)
+{
+    if (mStarted)
+        return;
+    mStarted = true;
+    mStates = schema.size();
+    std::vector<std::string> names(mStates);
+    for (auto &column : schema)
+        names[column.second] = column.first;
+
+    const uint32_t interval = mKeyframeInterval;
+    const uint32_t states = mStates;
+    mOutputfile.write(EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC));
+    mOutputfile.write(reinterpret_cast<const char *>(&EVENT_LOG_VERSION), sizeof(EVENT_LOG_VERSION));
+    mOutputfile.write(reinterpret_cast<const char *>(&interval), sizeof(interval));
+    mOutputfile.write(reinterpret_cast<const char *>(&states), sizeof(states));
+    for (std::string &name : names)
+    {
+        const uint32_t length = name.size();
+        mOutputfile.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        mOutputfile.write(name.data(), length);
+    }
+    writeStates(t, EventLog::KEYFRAME, values);
+}
+
+
+void EventLogWriter::event(double t, int transition, const double *values)
+{
+    if (!mStarted || mFinished)
+        return;
+    writeRecord(t, transition);
+    if (++mEvents == mKeyframeInterval)
+    {
+        writeStates(t, EventLog::KEYFRAME, values);
+        mEvents = 0;
+    }
+}
+
+
+void EventLogWriter::finish(double t, const double *values)
+{
+    if (!mStarted || mFinished)
+        return;
+    writeStates(t, EventLog::END, values);
+    mOutputfile.close();
+    mFinished = true;
+}
+
+
+EventLogReader::EventLogReader(std::string filename)
+{
+    mInputfile.open(filename, std::ios::binary);
+    char magic[sizeof(EVENT_LOG_MAGIC)];
+    uint32_t version = 0;
+    uint32_t states = 0;
+    if (!mInputfile.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC)) ||
+        !mInputfile.read(reinterpret_cast<char *>(&version), sizeof(version)) || version != EVENT_LOG_VERSION ||
+        !mInputfile.read(reinterpret_cast<char *>(&mKeyframeInterval), sizeof(mKeyframeInterval)) || mKeyframeInterval == 0 ||
+        !mInputfile.read(reinterpret_cast<char *>(&states), sizeof(states)))
+        return;
+    for (uint32_t i = 0; i < states; i++)
+    {
+        uint32_t length = 0;
+        if (!mInputfile.read(reinterpret_cast<char *>(&length), sizeof(length)))
+            return;
+        std::string name(length, ' ');
+        if (!mInputfile.read(&name[0], length))
+            return;
+        mNames.push_back(name);
+    }
+    mFirstKeyframe = mInputfile.tellg();
+    mInputfile.seekg(0, std::ios::end);
+    mEnd = mInputfile.tellg();
+    mInputfile.seekg(mFirstKeyframe);
+    mGood = true;
+}
+
+
+bool EventLogReader::good() const
+{
+    return (mGood);
+}
+
+
+const std::vector<std::string> &EventLogReader::getNames() const
+{
+    return (mNames);
+}
+
+
+bool EventLogReader::readRecord(double &t, int &transition)
+{
+    int32_t index = 0;
+    if (!mInputfile.read(reinterpret_cast<char *>(&t), sizeof(t)) || !mInputfile.read(reinterpret_cast<char *>(&index), sizeof(index)))
+        return (false);
+    transition = index;
+    return (true);
+}
+
+
+//Keyframe k follows k blocks of K events, each block ending in a keyframe.
+bool EventLogReader::readKeyframe(uint64_t k, double &t, state_vector &values)
+{
+    const std::streamoff keyframe_size = EVENT_RECORD_SIZE + mNames.size() * sizeof(double);
+    mInputfile.clear();
+    mInputfile.seekg(mFirstKeyframe + k * (mKeyframeInterval * EVENT_RECORD_SIZE + keyframe_size));
+    int transition = 0;
+    values.resize(mNames.size());
+    return (readRecord(t, transition) && transition == EventLog::KEYFRAME &&
+            mInputfile.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(double)));
+}
+
+
+//Keyframe times never decrease, so the last one at or before t is found by bisection.
+bool EventLogReader::seek(double t, double &keyframe_t, state_vector &values)
+{
+    if (!mGood || !readKeyframe(0, keyframe_t, values))
+        return (false);
+    const std::streamoff block_size = mKeyframeInterval * EVENT_RECORD_SIZE + EVENT_RECORD_SIZE + mNames.size() * sizeof(double);
+    uint64_t low = 0;
+    uint64_t high = (mEnd - mFirstKeyframe) / block_size;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low + 1) / 2;
+        double middle_t = 0;
+        if (readKeyframe(middle, middle_t, values) && middle_t <= t)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return (readKeyframe(low, keyframe_t, values));
+}
+
+
+bool EventLogReader::next(double &t, int &transition, state_vector &values)
+{
+    while (mGood && readRecord(t, transition))
+    {
+        if (transition >= 0)
+            return (true);
+        if (transition == EventLog::END)
+        {
+            values.resize(mNames.size());
+            return (bool(mInputfile.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(double))));
+        }
+        mInputfile.seekg(mNames.size() * sizeof(double), std::ios::cur);
+    }
+    return (false);
+}
@@ -0,0 +1,78 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "StateValues.h"
+
+//An event log records a stochastic run as the transition fired at each event rather than the states
+//after it: 12 bytes per event, where a row of states takes 8 bytes per state. The states at any time are
+//recovered by replaying the transitions onto the last keyframe before it (MarkovChain::replayEventLog).
+//
+//Layout, with every number in native byte order:
+//  header:  "MCEL", uint32 version (1), uint32 keyframe interval K, uint32 state count, then per state,
+//           in slot order, a uint32 name length and the name.
+//  records: double t and int32 transition. A transition of KEYFRAME or END is followed by the value of
+//           every state, in slot order.
+//The first record is a keyframe holding the initial states, and a keyframe follows every K events, so
+//keyframe k always starts at the same offset and can be found without an index. The END record holds
+//the time the run was serialised to at its end, and its final states.
+namespace EventLog
+{
+const int KEYFRAME = -1;
+const int END = -2;
+}
+
+class EventLogWriter
+{
+private:
+    std::ofstream mOutputfile;
+    int mKeyframeInterval;
+    int mEvents = 0;
+    size_t mStates = 0;
+    bool mStarted = false;
+    bool mFinished = false;
+    void writeRecord(double t, int transition);
+    void writeStates(double t, int kind, const double *values);
+
+public:
+    EventLogWriter(std::string filename, int keyframe_interval = 1024);
+    //Writes the header and the initial keyframe. A writer records a single run: later calls do nothing.
+    void start(const state_index &schema, double t, const double *values);
+    //The transition fired at t, and the states after it.
+    void event(double t, int transition, const double *values);
+    void finish(double t, const double *values);
+};
+
+
+//Reads an event log record by record, after moving to a keyframe.
+class EventLogReader
+{
+private:
+    std::ifstream mInputfile;
+    bool mGood = false;
+    uint32_t mKeyframeInterval = 0;
+    std::vector<std::string> mNames;
+    std::streamoff mFirstKeyframe = 0;
+    std::streamoff mEnd = 0;
+    bool readRecord(double &t, int &transition);
+    bool readKeyframe(uint64_t k, double &t, state_vector &values);
+
+public:
+    EventLogReader(std::string filename);
+    //False if the file could not be opened or is not an event log.
+    bool good() const;
+    //The state names, in slot order.
+    const std::vector<std::string> &getNames() const;
+    //Moves to the last keyframe at or before t, or the first keyframe if t is earlier, and gives its time
+    //and states. Reading carries on from the event after it.
+    bool seek(double t, double &keyframe_t, state_vector &values);
+    //The next event's time and transition. Keyframes are skipped. The END record gives END and the end
+    //time, with its states in values. Returns false at the end of the file.
+    bool next(double &t, int &transition, state_vector &values);
+};
+
+#endif
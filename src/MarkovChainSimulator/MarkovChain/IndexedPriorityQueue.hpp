@@ -0,0 +1,101 @@
+#ifndef INDEXEDPRIORITYQUEUE_H
+#define INDEXEDPRIORITYQUEUE_H
+
+#include <vector>
+#include <utility>
+
+//Binary min-heap over a fixed set of items 0..n-1, keyed by a double.
+//Keeps the heap position of every item so that a single key can be changed in O(log n).
+class IndexedPriorityQueue
+{
+private:
+    std::vector<double> mKeys;
+    std::vector<int> mHeap;
+    std::vector<int> mPosition;
+
+    void swapNodes(int a, int b)
+    {
+        std::swap(mHeap[a], mHeap[b]);
+        mPosition[mHeap[a]] = a;
+        mPosition[mHeap[b]] = b;
+    }
+
+    void siftUp(int node)
+    {
+        while (node > 0)
+        {
+            int parent = (node - 1) / 2;
+            if (mKeys[mHeap[parent]] <= mKeys[mHeap[node]])
+                break;
+            swapNodes(node, parent);
+            node = parent;
+        }
+    }
+
+    void siftDown(int node)
+    {
+        int size = mHeap.size();
+        while (true)
+        {
+            int smallest = node;
+            int left = 2 * node + 1;
+            int right = left + 1;
+            if (left < size && mKeys[mHeap[left]] < mKeys[mHeap[smallest]])
+                smallest = left;
+            if (right < size && mKeys[mHeap[right]] < mKeys[mHeap[smallest]])
+                smallest = right;
+            if (smallest == node)
+                break;
+            swapNodes(node, smallest);
+            node = smallest;
+        }
+    }
+
+public:
+    IndexedPriorityQueue() = default;
+
+    IndexedPriorityQueue(const std::vector<double> &keys) : mKeys(keys), mHeap(keys.size()), mPosition(keys.size())
+    {
+        for (size_t i = 0; i < mHeap.size(); i++)
+        {
+            mHeap[i] = i;
+            mPosition[i] = i;
+        }
+        for (int i = (int)mHeap.size() / 2 - 1; i >= 0; i--)
+        {
+            siftDown(i);
+        }
+    }
+
+    int top() const
+    {
+        return (mHeap[0]);
+    }
+
+    double topKey() const
+    {
+        return (mKeys[mHeap[0]]);
+    }
+
+    double getKey(int item) const
+    {
+        return (mKeys[item]);
+    }
+
+    void update(int item, double key)
+    {
+        double old_key = mKeys[item];
+        mKeys[item] = key;
+        if (key < old_key)
+            siftUp(mPosition[item]);
+        else
+            siftDown(mPosition[item]);
+    }
+
+    bool empty() const
+    {
+        return (mHeap.empty());
+    }
+};
+
+#endif
@@ -2,77 +2,99 @@
 
 namespace Deterministic
 {
-State::State(Map const &map) : mMap(map) {}
+State::State(state_vector values, Names names) : mValues(std::move(values)), mNames(std::move(names)) {}
 
-void State::addToKey(std::string key, double a)
+const state_vector &State::getValues() const
 {
-    mMap[key] += a;
+    return (mValues);
+}
+
+void State::fill(double a)
+{
+    std::fill(mValues.begin(), mValues.end(), a);
 }
 
 State &State::operator+=(const State &p)
 {
-    auto map = p.mMap;
-    for (auto &p : map)
-        mMap[p.first] += p.second;
+    if (mValues.empty())
+    {
+        resize(p);
+        fill(0);
+    }
+    double *values = mValues.data();
+    const double *other = p.mValues.data();
+    const size_t n = mValues.size();
+    for (size_t i = 0; i < n; i++)
+        values[i] += other[i];
     return *this;
 }
 
 State &State::operator+=(double a)
 {
-    for (auto &p : mMap)
-        p.second += a;
+    double *values = mValues.data();
+    const size_t n = mValues.size();
+    for (size_t i = 0; i < n; i++)
+        values[i] += a;
     return *this;
 }
 
 State &State::operator*=(double f)
 {
-    for (auto &p : mMap)
-        mMap[p.first] *= f;
+    double *values = mValues.data();
+    const size_t n = mValues.size();
+    for (size_t i = 0; i < n; i++)
+        values[i] *= f;
     return *this;
 }
 
 State abs(const State &p)
 {
-    using std::abs;
-    auto map = p.mMap;
-
-    for (auto &e : map)
-        e.second = abs(e.second);
-
-    return map;
+    State result(p);
+    double *values = result.mValues.data();
+    const size_t n = result.mValues.size();
+    for (size_t i = 0; i < n; i++)
+        values[i] = std::fabs(values[i]);
+    return result;
 }
 
 State operator/(const State &p1, const State &p2)
 {
-    auto map = p1.mMap;
-
-    for (auto &e : map)
-        e.second /= p2.mMap.at(e.first);
-
-    return map;
+    State result(p1);
+    double *values = result.mValues.data();
+    const double *divisors = p2.mValues.data();
+    const size_t n = result.mValues.size();
+    for (size_t i = 0; i < n; i++)
+        values[i] /= divisors[i];
+    return result;
 }
 
 double vector_space_norm_inf_impl(State const &p)
 {
     double max = 0;
-    using std::abs;
-    for (auto &el : p.mMap)
-        max = std::max(abs(el.second), max);
+    const double *values = p.mValues.data();
+    const size_t n = p.mValues.size();
+    for (size_t i = 0; i < n; i++)
+        max = std::max(std::fabs(values[i]), max);
     return max;
 }
 
-size_t State::size() const { return mMap.size(); }
+size_t State::size() const { return mValues.size(); }
 
 void State::resize(State const &other)
 {
-    for (auto &el : other.mMap)
-        mMap[el.first] += 0; // inserts if non-existent
+    mValues.resize(other.mValues.size());
+    mNames = other.mNames;
 }
 
 using Map = std::map<std::string, double>;
 Map State::getMap() const
 {
-    return (mMap);
+    Map map;
+    if (!mNames)
+        return (map);
+    for (size_t i = 0; i < mValues.size(); i++)
+        map.emplace_hint(map.end(), (*mNames)[i], mValues[i]);
+    return (map);
 }
 }
 
@@ -152,148 +174,664 @@ unsigned long MarkovChain::mix(unsigned long a, unsigned long b, unsigned long c
     return c;
 }
 
+double MarkovChain::runif()
+{
+    return (mGenerator.uniform());
+}
+
+state_vector MarkovChain::toStateVector(const state_values &state_values) const
+{
+    state_vector state_vector(mStateIndex.size(), 0);
+    for (auto &entry : state_values)
+    {
+        state_index::const_iterator it = mStateIndex.find(entry.first);
+        if (it != mStateIndex.end())
+            state_vector[it->second] = entry.second;
+    }
+    return (state_vector);
+}
+
+bool MarkovChain::checkRate(int transition, double rate, const state_vector &current_states) const
+{
+    if (rate < 0.0 || std::isnan(rate))
+    {
+        int source = transitions[transition]->getSourceIndex();
+        int destination = transitions[transition]->getDestinationIndex();
+        *mpLog << "Transition from " << transitions[transition]->getSourceState() << " to " << transitions[transition]->getDestinationState() << " has rate " << rate << std::endl;
+        *mpLog << "States have values " << (source >= 0 ? current_states[source] : 0) << " and " << (destination >= 0 ? current_states[destination] : 0) << std::endl;
+        return (false);
+    }
+    return (true);
+}
+
+//Direct method. Rates live in a sum tree, so choosing the next transition is O(log n), and after each
+//event only the rates in the fired transition's dependency list are recomputed.
 void MarkovChain::solveGillespie()
 {
-    double t = 0;
+    double t = mStartTime;
     bool ended_infinite = false;
 
-    int population_size = 0;
-    for (typename state_values::iterator it = states.begin(); it != states.end(); it++)
+    state_vector current_states = toStateVector(states);
+    for (double value : current_states)
+    {
+        assert(value >= 0);
+    }
+    std::vector<std::vector<int>> dependents = buildDependencyGraph();
+
+    startRealisation(current_states);
+
+    mpSerialiser->serialiseHeader(mStateIndex);
+    if (mpEventLog)
+        mpEventLog->start(mStateIndex, t, current_states.data());
+
+    PropensitySumTree rates(transitions.size());
+    bool valid = true;
+    for (int i = 0; valid && i < transitions.size(); i++)
     {
-        assert(it->second >= 0);
-        population_size += it->second;
+        double rate = transitions[i]->getRate(current_states);
+        valid = checkRate(i, rate, current_states);
+        rates.setLeaf(i, rate);
     }
+    rates.rebuild();
 
-    typedef boost::uniform_real<> NumberDistribution;
-    typedef boost::mt19937 RandomNumberGenerator;
-    typedef boost::variate_generator<RandomNumberGenerator &,
-                                     NumberDistribution>
-        Generator;
+    while (valid && t < T_MAX && !ended_infinite && !stopEarly(t, current_states.data()))
+    {
+        double rates_sum = rates.total();
 
-    NumberDistribution distribution(0, 1);
-    RandomNumberGenerator generator;
-    Generator runif(generator, distribution);
-    
-    generator.seed(seed); // seed with the current time
+        double event_time = -(1.0 / rates_sum) * log(runif());
+        if (std::isinf(event_time))
+        {
+            ended_infinite = true;
+            break;
+        }
+        //The next event falls after T_MAX, so the run ends in the state it holds there.
+        if (t + event_time > T_MAX)
+            break;
+        serialiseState(t, t + event_time, current_states);
+        t += event_time;
 
-    mpSerialiser->serialiseHeader(states);
+        int eventOccurred = rates.sample(runif());
+        transitions[eventOccurred]->do_transition(t, current_states);
+        if (mpEventLog)
+            mpEventLog->event(t, eventOccurred, current_states.data());
 
-    mpSerialiser->serialise(t, states);
+        for (int j : dependents[eventOccurred])
+        {
+            double rate = transitions[j]->getRate(current_states);
+            valid = checkRate(j, rate, current_states);
+            if (!valid)
+                break;
+            rates.update(j, rate);
+        }
+    }
+    serialiseState(t, endTime(t), current_states);
+    recordEnd(current_states.data());
+    mpSerialiser->serialiseFinally(endTime(t), current_states.data());
+    if (mpEventLog)
+        mpEventLog->finish(endTime(t), current_states.data());
+}
 
-    while (t < T_MAX && !ended_infinite)
+std::vector<std::vector<int>> MarkovChain::buildDependencyGraph() const
+{
+    //For every state, the transitions whose rate reads it.
+    std::vector<std::vector<int>> readers(mStateIndex.size());
+    for (int i = 0; i < transitions.size(); i++)
     {
-        int actual_size = 0;
-        for (typename state_values::iterator it = states.begin(); it != states.end(); it++)
+        for (int state : transitions[i]->getRateDependencies())
         {
-            assert(it->second >= 0);
-            actual_size += it->second;
+            readers[state].push_back(i);
         }
-        //assert(actual_size == population_size);
+    }
 
-        std::vector<double> rates(transitions.size());
-        for (int i = 0; i < transitions.size(); i++)
+    //For every transition, the transitions whose rate can change when it fires (always including itself).
+    std::vector<std::vector<int>> dependents(transitions.size());
+    std::vector<int> last_seen(transitions.size(), -1);
+    for (int i = 0; i < transitions.size(); i++)
+    {
+        dependents[i].push_back(i);
+        last_seen[i] = i;
+        for (int state : transitions[i]->getAffectedStates())
         {
-            rates[i] = transitions[i]->getRate(states);
-            if (rates[i] < 0.0 || std::isnan(rates[i]))
+            for (int j : readers[state])
             {
-                std::cout << "Transition from " << transitions[i]->getSourceState() << " to " << transitions[i]->getDestinationState() << " has rate " << rates[i] << std::endl;
-                std::cout << "States have values " << states[transitions[i]->getSourceState()] << " and " << states[transitions[i]->getDestinationState()] << std::endl;
-                return;
+                if (last_seen[j] != i)
+                {
+                    dependents[i].push_back(j);
+                    last_seen[j] = i;
+                }
             }
-            assert(rates[i] >= 0);
         }
-        double rates_sum = std::accumulate(rates.begin(), rates.end(), (double)0.0);
+    }
+    return (dependents);
+}
 
-        double event_time = -(1.0 / rates_sum) * log(runif());
-        if (std::isinf(event_time))
+//Gibson & Bruck's next reaction method: every transition keeps an absolute firing time in an
+//indexed priority queue, and only the rates in the fired transition's dependency list are recomputed.
+void MarkovChain::solveNextReaction()
+{
+    double t = mStartTime;
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    state_vector current_states = toStateVector(states);
+    std::vector<std::vector<int>> dependents = buildDependencyGraph();
+
+    startRealisation(current_states);
+
+    mpSerialiser->serialiseHeader(mStateIndex);
+    if (mpEventLog)
+        mpEventLog->start(mStateIndex, t, current_states.data());
+
+    std::vector<double> rates(transitions.size());
+    std::vector<double> firing_times(transitions.size(), infinity);
+    bool valid = true;
+    for (int i = 0; valid && i < transitions.size(); i++)
+    {
+        rates[i] = transitions[i]->getRate(current_states);
+        valid = checkRate(i, rates[i], current_states);
+        if (valid)
+            firing_times[i] = rates[i] > 0 ? t - log(runif()) / rates[i] : infinity;
+    }
+    IndexedPriorityQueue queue(firing_times);
+
+    while (valid && t < T_MAX && !queue.empty() && !stopEarly(t, current_states.data()))
+    {
+        int eventOccurred = queue.top();
+        if (queue.topKey() > T_MAX)
+            break;
+        serialiseState(t, queue.topKey(), current_states);
+        t = queue.topKey();
+
+        transitions[eventOccurred]->do_transition(t, current_states);
+        if (mpEventLog)
+            mpEventLog->event(t, eventOccurred, current_states.data());
+
+        for (int j : dependents[eventOccurred])
         {
-            ended_infinite = true;
+            double old_rate = rates[j];
+            double new_rate = transitions[j]->getRate(current_states);
+            valid = checkRate(j, new_rate, current_states);
+            if (!valid)
+                break;
+            rates[j] = new_rate;
+
+            double firing_time = infinity;
+            if (new_rate > 0)
+            {
+                if (j != eventOccurred && old_rate > 0)
+                    firing_time = t + (old_rate / new_rate) * (queue.getKey(j) - t);
+                else
+                    firing_time = t - log(runif()) / new_rate;
+            }
+            queue.update(j, firing_time);
+        }
+    }
+    serialiseState(t, endTime(t), current_states);
+    recordEnd(current_states.data());
+    mpSerialiser->serialiseFinally(endTime(t), current_states.data());
+    if (mpEventLog)
+        mpEventLog->finish(endTime(t), current_states.data());
+}
+
+//Adaptive explicit tau-leaping (Cao, Gillespie & Petzold, 2006). The leap is chosen so that no rate
+//is expected to change by more than a fraction epsilon of itself. Transitions that could empty their
+//source within a few firings are critical: they are never leapt, and at most one of them fires per
+//step. When the leap would be too short to be worth it, a burst of exact SSA steps is taken instead.
+void MarkovChain::solveTauLeap()
+{
+    const int critical_threshold = 10;
+    const double ssa_threshold = 10;
+    const int ssa_steps = 100;
+
+    double t = mStartTime;
+    const double infinity = std::numeric_limits<double>::infinity();
+
+    state_vector current_states = toStateVector(states);
+    int num_states = current_states.size();
+
+    std::vector<bool> is_reactant(num_states, false);
+    std::vector<double> order(num_states, 1);
+    for (int j = 0; j < transitions.size(); j++)
+    {
+        if (transitions[j]->getSourceIndex() >= 0)
+            is_reactant[transitions[j]->getSourceIndex()] = true;
+        for (int state : transitions[j]->getRateDependencies())
+            order[state] = std::max(order[state], (double)transitions[j]->getOrder());
+    }
+
+    startRealisation(current_states);
+
+    mpSerialiser->serialiseHeader(mStateIndex);
+
+    std::vector<double> rates(transitions.size());
+    std::vector<bool> critical(transitions.size());
+    std::vector<double> firings(transitions.size());
+    std::vector<double> mean_change(num_states);
+    std::vector<double> variance_change(num_states);
+    state_vector proposed_states(num_states);
+
+    bool ended = false;
+    bool valid = true;
+    while (valid && t < T_MAX && !ended && !stopEarly(t, current_states.data()))
+    {
+        double rates_sum = 0;
+        for (int j = 0; valid && j < transitions.size(); j++)
+        {
+            rates[j] = transitions[j]->getRate(current_states);
+            valid = checkRate(j, rates[j], current_states);
+            rates_sum += rates[j];
+        }
+        if (!valid || rates_sum == 0)
             break;
+
+        double critical_sum = 0;
+        std::fill(mean_change.begin(), mean_change.end(), 0);
+        std::fill(variance_change.begin(), variance_change.end(), 0);
+        for (int j = 0; j < transitions.size(); j++)
+        {
+            int source = transitions[j]->getSourceIndex();
+            critical[j] = rates[j] > 0 && source >= 0 && current_states[source] < critical_threshold;
+            if (critical[j])
+            {
+                critical_sum += rates[j];
+                continue;
+            }
+            for (int k = mStoichiometry.rowBegin(j); k < mStoichiometry.rowEnd(j); k++)
+            {
+                double change = mStoichiometry.getValue(k);
+                mean_change[mStoichiometry.getColumn(k)] += change * rates[j];
+                variance_change[mStoichiometry.getColumn(k)] += change * change * rates[j];
+            }
         }
-        t += event_time;
 
-        std::vector<double> rates_normalised(rates.size());
-        rates_normalised[0] = rates[0] / rates_sum;
+        double tau_noncritical = infinity;
+        for (int i = 0; i < num_states; i++)
+        {
+            if (!is_reactant[i])
+                continue;
+            double bound = std::max(mTauLeapEpsilon * current_states[i] / order[i], 1.0);
+            if (mean_change[i] != 0)
+                tau_noncritical = std::min(tau_noncritical, bound / std::abs(mean_change[i]));
+            if (variance_change[i] > 0)
+                tau_noncritical = std::min(tau_noncritical, bound * bound / variance_change[i]);
+        }
+
+        if (tau_noncritical < ssa_threshold / rates_sum)
+        {
+            //Leaping would cover only a handful of events: take exact steps instead.
+            for (int step = 0; step < ssa_steps && t < T_MAX && !stopEarly(t, current_states.data()); step++)
+            {
+                if (step > 0)
+                {
+                    rates_sum = 0;
+                    for (int j = 0; valid && j < transitions.size(); j++)
+                    {
+                        rates[j] = transitions[j]->getRate(current_states);
+                        valid = checkRate(j, rates[j], current_states);
+                        rates_sum += rates[j];
+                    }
+                    if (!valid)
+                        break;
+                }
+                double event_time = -(1.0 / rates_sum) * log(runif());
+                if (std::isinf(event_time))
+                    break;
+                if (t + event_time > T_MAX)
+                {
+                    ended = true;
+                    break;
+                }
+                serialiseState(t, t + event_time, current_states);
+                t += event_time;
+
+                double target = runif() * rates_sum;
+                int eventOccurred = 0;
+                while (eventOccurred < transitions.size() - 1 && (target >= rates[eventOccurred] || rates[eventOccurred] == 0))
+                {
+                    target -= rates[eventOccurred];
+                    eventOccurred++;
+                }
+                transitions[eventOccurred]->do_transition(t, current_states);
+            }
+            continue;
+        }
+
+        while (true)
+        {
+            double tau_critical = critical_sum > 0 ? -log(runif()) / critical_sum : infinity;
+            double tau = std::min(std::min(tau_noncritical, tau_critical), T_MAX - t);
+
+            std::fill(firings.begin(), firings.end(), 0);
+            for (int j = 0; j < transitions.size(); j++)
+            {
+                if (!critical[j] && rates[j] > 0)
+                {
+                    boost::random::poisson_distribution<long, double> poisson(rates[j] * tau);
+                    firings[j] = poisson(mGenerator);
+                }
+            }
+            if (tau_critical <= tau)
+            {
+                //Should rounding leave target past the last critical rate, that transition fires.
+                double target = runif() * critical_sum;
+                int eventOccurred = -1;
+                for (int j = 0; j < transitions.size(); j++)
+                {
+                    if (!critical[j] || rates[j] <= 0)
+                        continue;
+                    eventOccurred = j;
+                    if (target < rates[j])
+                        break;
+                    target -= rates[j];
+                }
+                if (eventOccurred >= 0)
+                    firings[eventOccurred] = 1;
+            }
+
+            proposed_states = current_states;
+            bool negative = false;
+            for (int j = 0; j < transitions.size(); j++)
+            {
+                if (firings[j] == 0)
+                    continue;
+                for (int k = mStoichiometry.rowBegin(j); k < mStoichiometry.rowEnd(j); k++)
+                    proposed_states[mStoichiometry.getColumn(k)] += mStoichiometry.getValue(k) * firings[j];
+            }
+            for (double value : proposed_states)
+                negative = negative || value < 0;
+
+            if (!negative)
+            {
+                serialiseState(t, std::min(t + tau, T_MAX), current_states);
+                t = std::min(t + tau, T_MAX);
+                current_states.swap(proposed_states);
+                break;
+            }
+            tau_noncritical /= 2;
+        }
+    }
+    serialiseState(t, endTime(t), current_states);
+    recordEnd(current_states.data());
+    mpSerialiser->serialiseFinally(endTime(t), current_states.data());
+}
+
+//Right hand side of the hybrid system: fast transitions move the continuous state, and slow
+//transitions contribute only to the total slow rate, whose integral decides when a jump occurs.
+void MarkovChain::hybridDerivative(const state_vector &y, const std::vector<bool> &fast, state_vector &dydt, double &slow_rate)
+{
+    std::fill(dydt.begin(), dydt.end(), 0);
+    slow_rate = 0;
+    for (int j = 0; j < transitions.size(); j++)
+    {
+        double rate = transitions[j]->getRate(y);
+        if (!fast[j])
+        {
+            slow_rate += rate;
+            continue;
+        }
+        for (int k = mStoichiometry.rowBegin(j); k < mStoichiometry.rowEnd(j); k++)
+            dydt[mStoichiometry.getColumn(k)] += mStoichiometry.getValue(k) * rate;
+    }
+}
+
+void MarkovChain::hybridStep(const state_vector &y, const std::vector<bool> &fast, double h, state_vector &y_next, double &integrated_slow_rate)
+{
+    int n = y.size();
+    state_vector &k_1 = mHybridSlopes[0], &k_2 = mHybridSlopes[1], &k_3 = mHybridSlopes[2], &k_4 = mHybridSlopes[3];
+    state_vector &stage = mHybridStage;
+    double s_1, s_2, s_3, s_4;
+
+    hybridDerivative(y, fast, k_1, s_1);
+    for (int i = 0; i < n; i++)
+        stage[i] = y[i] + (h / 2) * k_1[i];
+    hybridDerivative(stage, fast, k_2, s_2);
+    for (int i = 0; i < n; i++)
+        stage[i] = y[i] + (h / 2) * k_2[i];
+    hybridDerivative(stage, fast, k_3, s_3);
+    for (int i = 0; i < n; i++)
+        stage[i] = y[i] + h * k_3[i];
+    hybridDerivative(stage, fast, k_4, s_4);
+
+    y_next.resize(n);
+    for (int i = 0; i < n; i++)
+        y_next[i] = y[i] + (h / 6) * (k_1[i] + 2 * k_2[i] + 2 * k_3[i] + k_4[i]);
+    integrated_slow_rate = (h / 6) * (s_1 + 2 * s_2 + 2 * s_3 + s_4);
+}
+
+//Hybrid solver. Fast transitions are integrated as ODEs with RK4 and slow transitions fire as exact
+//jumps: the next jump happens when the integral of the total slow rate reaches an Exp(1) threshold,
+//and the step that crosses it is shortened to land on the crossing. The flows can overshoot a nearly
+//empty compartment, so states are clamped at zero after every step.
+void MarkovChain::solveHybrid()
+{
+    double t = mStartTime;
+
+    state_vector current_states = toStateVector(states);
+    state_vector next_states(current_states.size());
+    std::vector<bool> fast(transitions.size());
+    std::vector<double> rates(transitions.size());
+    for (state_vector &slope : mHybridSlopes)
+        slope.assign(current_states.size(), 0);
+    mHybridStage.assign(current_states.size(), 0);
+
+    startRealisation(current_states);
 
-        for (int i = 1; i < rates.size(); i++)
+    mpSerialiser->serialiseHeader(mStateIndex);
+
+    double threshold = -log(runif());
+    bool valid = true;
+    while (valid && t < T_MAX && !stopEarly(t, current_states.data()))
+    {
+        for (int j = 0; valid && j < transitions.size(); j++)
+        {
+            rates[j] = transitions[j]->getRate(current_states);
+            valid = checkRate(j, rates[j], current_states);
+            int source = transitions[j]->getSourceIndex();
+            switch (transitions[j]->getPartition())
+            {
+            case Transition::PARTITION_FAST:
+                fast[j] = true;
+                break;
+            case Transition::PARTITION_SLOW:
+                fast[j] = false;
+                break;
+            default:
+                fast[j] = rates[j] >= mHybridRateThreshold && (source < 0 || current_states[source] >= mHybridPopulationThreshold);
+            }
+        }
+        if (!valid)
+            break;
+
+        double h = std::min(mHybridStepSize, T_MAX - t);
+        double integrated_slow_rate;
+        hybridStep(current_states, fast, h, next_states, integrated_slow_rate);
+
+        if (integrated_slow_rate < threshold)
         {
-            rates_normalised[i] = rates_normalised[i - 1] + (rates[i] / rates_sum);
+            threshold -= integrated_slow_rate;
+            clampStates(next_states);
+            serialiseState(t, std::min(t + h, T_MAX), current_states);
+            t = std::min(t + h, T_MAX);
+            current_states.swap(next_states);
+            continue;
         }
 
-        int eventOccurred = 0;
-        double u = runif();
+        //A slow transition fires within this step: land on the crossing and fire it there.
+        h = findSlowCrossing(current_states, fast, h, integrated_slow_rate, threshold, next_states);
+        clampStates(next_states);
+        serialiseState(t, t + h, current_states);
+        t += h;
+        current_states.swap(next_states);
+
+        double slow_sum = 0;
+        for (int j = 0; j < transitions.size(); j++)
+        {
+            rates[j] = fast[j] ? 0 : transitions[j]->getRate(current_states);
+            slow_sum += rates[j];
+        }
+        if (slow_sum > 0)
+        {
+            double target = runif() * slow_sum;
+            int eventOccurred = 0;
+            while (eventOccurred < transitions.size() - 1 && (target >= rates[eventOccurred] || rates[eventOccurred] == 0))
+            {
+                target -= rates[eventOccurred];
+                eventOccurred++;
+            }
+            transitions[eventOccurred]->do_transition(t, current_states);
+        }
+        threshold = -log(runif());
+    }
+    serialiseState(t, endTime(t), current_states);
+    recordEnd(current_states.data());
+    mpSerialiser->serialiseFinally(endTime(t), current_states.data());
+}
 
-        while (u > rates_normalised[eventOccurred])
+//The step length within [0, h] at which the integrated slow rate reaches threshold, found by Illinois
+//regula falsi: the rates change within the step, so the integral is not linear in the step length.
+//integrated_slow_rate holds the integral over all of h on entry. y_next is left holding the state
+//after the returned step.
+double MarkovChain::findSlowCrossing(const state_vector &y, const std::vector<bool> &fast, double h, double integrated_slow_rate, double threshold, state_vector &y_next)
+{
+    double low = 0, low_excess = -threshold;
+    double high = h, high_excess = integrated_slow_rate - threshold;
+    double step = h;
+    int side = 0;
+    for (int iteration = 0; iteration < 50; iteration++)
+    {
+        step = (low * high_excess - high * low_excess) / (high_excess - low_excess);
+        double integral;
+        hybridStep(y, fast, step, y_next, integral);
+        double excess = integral - threshold;
+        if (std::fabs(excess) <= 1e-12 * threshold || high - low <= 1e-12 * h)
+            return (step);
+        if (excess < 0)
         {
-            eventOccurred++;
+            low = step;
+            low_excess = excess;
+            if (side == -1)
+                high_excess /= 2;
+            side = -1;
+        }
+        else
+        {
+            high = step;
+            high_excess = excess;
+            if (side == 1)
+                low_excess /= 2;
+            side = 1;
         }
-        transitions[eventOccurred]->do_transition(t, states);
-        mpSerialiser->serialise(t, states);
     }
-    mpSerialiser->serialiseFinally(t, states);
+    return (step);
 }
 
-void MarkovChain::derivative(const DeterministicStateType p, DeterministicStateType &dpdt, const double t)
+void MarkovChain::clampStates(state_vector &y)
 {
+    for (double &value : y)
+        value = std::max(value, 0.0);
+}
+
+//Each rate is evaluated once, then the stoichiometry matrix maps the rates onto every state,
+//counters included.
+void MarkovChain::derivative(const DeterministicStateType &p, DeterministicStateType &dpdt, const double t)
+{
+    dpdt.resize(p);
+    const state_vector &current_states = p.getValues();
     for (int i = 0; i < transitions.size(); i++)
     {
-        dpdt.addToKey(transitions[i]->getSourceState(), -1 * transitions[i]->getRate(p.getMap()));
-        dpdt.addToKey(transitions[i]->getDestinationState(), transitions[i]->getRate(p.getMap()));
+        mPropensities[i] = transitions[i]->getRate(current_states);
     }
+    mStoichiometry.multiplyTransposed(mPropensities.data(), &dpdt[0]);
 }
 
-void MarkovChain::serialiserDeterministic(const DeterministicStateType &p, const double t)
+//Observer for the deterministic solvers: p is the state at t, and the solution moves on at next_t.
+void MarkovChain::serialiserDeterministic(const DeterministicStateType &p, const double t, const double next_t)
 {
-    mpSerialiser->serialise(t, p.getMap());
+    if (needsState(mpSerialiser, next_t))
+        mpSerialiser->serialise(t, p.getValues().data());
 }
 
+//Adaptive Cash-Karp from odeint. The chain is bound by reference, so its transitions are not copied.
 void MarkovChain::solveDeterministic()
 {
-    DeterministicStateType x0(states);
+    DeterministicStateType x0(toStateVector(states), mStateNames);
     typedef runge_kutta_cash_karp54<DeterministicStateType, double, DeterministicStateType, double, vector_space_algebra>
         rkck54;
 
-    //typedef controlled_runge_kutta< rkck54, double, DeterministicStateType, double, vector_space_algebra > ctrl_rkck54;
-    mpSerialiser->serialiseHeader(x0.getMap());
-    integrate_adaptive(make_controlled(1e-10, 1e-6, rkck54()), std::bind(&MarkovChain::derivative, *this, pl::_1, pl::_2, pl::_3), x0, 0.0,
-                       T_MAX, 0.1,
-                       std::bind(&MarkovChain::serialiserDeterministic, *this, pl::_1, pl::_2));
+    mpSerialiser->serialiseHeader(mStateIndex);
+    //Stepping through the range rather than calling integrate_adaptive lets a stopping condition end
+    //the integration. x0 follows the iteration.
+    auto steps = make_adaptive_time_range(make_controlled(1e-10, 1e-6, rkck54()), std::bind(&MarkovChain::derivative, this, pl::_1, pl::_2, pl::_3), x0, mStartTime,
+                                          T_MAX, 0.1);
+    //A point is only handed to the serialiser once the time of the next one is known, so the range's
+    //first point, the initial state, is held back until the second.
+    double t = T_MAX;
+    double previous_t = mStartTime;
+    DeterministicStateType previous(x0);
+    for (auto step = steps.first; step != steps.second; ++step)
+    {
+        if (step->second > previous_t)
+            serialiserDeterministic(previous, previous_t, step->second);
+        previous_t = step->second;
+        previous = step->first;
+        if (stopEarly(step->second, step->first.getValues().data()))
+        {
+            t = step->second;
+            break;
+        }
+    }
+    serialiserDeterministic(previous, previous_t, endTime(t));
 
-    mpSerialiser->serialiseFinally(T_MAX, x0.getMap());
+    recordEnd(&x0[0]);
+    mpSerialiser->serialiseFinally(endTime(t), &x0[0]);
 }
 
 void MarkovChain::solveRK4()
 {
-    DeterministicStateType y(states);
-    mpSerialiser->serialiseHeader(y.getMap());
-    double t = 0;
+    DeterministicStateType y(toStateVector(states), mStateNames);
+    mpSerialiser->serialiseHeader(mStateIndex);
+    double t = mStartTime;
     double h = 1.0 / 120;
     if (T_MAX < 5)
         h = 1.0 / (5000 * T_MAX);
+
+    const int n = y.size();
+    DeterministicStateType k_1(y), k_2(y), k_3(y), k_4(y), stage(y);
     while (t < T_MAX)
     {
-        mpSerialiser->serialise(t, y.getMap());
-        DeterministicStateType k_1;
-        DeterministicStateType k_2;
-        DeterministicStateType k_3;
-        DeterministicStateType k_4;
+        if (stopEarly(t, &y[0]))
+            break;
+        //The last step is shortened to end on T_MAX.
+        double step = std::min(h, T_MAX - t);
+        serialiserDeterministic(y, t, std::min(t + step, T_MAX));
         derivative(y, k_1, t);
-        derivative(y + (h / 2) * k_1, k_2, t + (h / 2));
-        derivative(y + (h / 2) * k_2, k_3, t + (h / 2));
-        derivative(y + h * k_3, k_4, t + h);
-
-        y += (h / 6) * (k_1 + 2 * k_2 + 2 * k_3 + k_4);
-        t += h;
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + (step / 2) * k_1[i];
+        derivative(stage, k_2, t + (step / 2));
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + (step / 2) * k_2[i];
+        derivative(stage, k_3, t + (step / 2));
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + step * k_3[i];
+        derivative(stage, k_4, t + step);
+
+        for (int i = 0; i < n; i++)
+            y[i] += (step / 6) * (k_1[i] + 2 * k_2[i] + 2 * k_3[i] + k_4[i]);
+        t = std::min(t + step, T_MAX);
     }
+    serialiserDeterministic(y, t, endTime(t));
 
-    mpSerialiser->serialiseFinally(t, y.getMap());
+    recordEnd(&y[0]);
+    mpSerialiser->serialiseFinally(endTime(t), &y[0]);
 }
 
-void MarkovChain::solveRKD5()
+//Dormand-Prince 5(4) from t to T_MAX, calling observer before every accepted step with the state,
+//the time and the time the step ends at. The state reached is left to the caller. Returns the time reached. The stage buffers are allocated once, and since the last stage is
+//evaluated at the new solution, its derivative is reused as the first stage of the next step (FSAL).
+//With several lanes, y interleaves independent systems (element i belongs to lane i % lanes) and
+//the step is controlled by the lane with the largest error. Stopping conditions are checked after
+//every accepted step of a single system, against its leading states.
+double MarkovChain::integrateRKD5(DeterministicStateType &y, double t, DeterministicSystem system, DeterministicObserver observer, int lanes)
 {
-    DeterministicStateType y(states);
-    mpSerialiser->serialiseHeader(y.getMap());
-    double t = 0;
     double tol = 0.00001;
 
     double a21 = 1.0 / 5.0;
@@ -312,7 +850,6 @@ void MarkovChain::solveRKD5()
     double a64 = 49.0 / 176.0;
     double a65 = -5103.0 / 18656.0;
     double a71 = 35.0 / 384.0;
-    double a72 = 0.0;
     double a73 = 500.0 / 1113.0;
     double a74 = 125.0 / 192.0;
     double a75 = -2187.0 / 6784.0;
@@ -326,7 +863,6 @@ void MarkovChain::solveRKD5()
     double c7 = 1;
 
     double b1 = 35.0 / 384.0;
-    double b2 = 0;
     double b3 = 500.0 / 1113.0;
     double b4 = 125.0 / 192.0;
     double b5 = -2187.0 / 6784.0;
@@ -334,50 +870,80 @@ void MarkovChain::solveRKD5()
     double b7 = 0;
 
     double b1p = 5179.0 / 57600.0;
-    double b2p = 0;
     double b3p = 7571.0 / 16695.0;
     double b4p = 393.0 / 640.0;
     double b5p = -92097.0 / 339200.0;
     double b6p = 187.0 / 2100.0;
     double b7p = 1.0 / 40.0;
 
+    double e1 = b1 - b1p;
+    double e3 = b3 - b3p;
+    double e4 = b4 - b4p;
+    double e5 = b5 - b5p;
+    double e6 = b6 - b6p;
+    double e7 = b7 - b7p;
+
     double h = 1;
 
+    const int n = y.size();
+    DeterministicStateType k_1(y), k_2(y), k_3(y), k_4(y), k_5(y), k_6(y), k_7(y), stage(y);
+    std::vector<double> lane_errors(lanes);
+    system(y, k_1, t);
     while (t < T_MAX)
     {
-        DeterministicStateType k_1;
-        DeterministicStateType k_2;
-        DeterministicStateType k_3;
-        DeterministicStateType k_4;
-        DeterministicStateType k_5;
-        DeterministicStateType k_6;
-        DeterministicStateType k_7;
-
-        derivative(y, k_1, t);
-        derivative(y + h * (a21 * k_1), k_2, t + c2 * h);
-        derivative(y + h * (a31 * k_1 + a32 * k_2), k_3, t + c3 * h);
-        derivative(y + h * (a41 * k_1 + a42 * k_2 + a43 * k_3), k_4, t + c4 * h);
-        derivative(y + h * (a51 * k_1 + a52 * k_2 + a53 * k_3 + a54 * k_4), k_5, t + c5 * h);
-        derivative(y + h * (a61 * k_1 + a62 * k_2 + a63 * k_3 + a64 * k_4 + a65 * k_5), k_6, t + c6 * h);
-        derivative(y + h * (a71 * k_1 + a72 * k_2 + a73 * k_3 + a74 * k_4 + a75 * k_5 + a76 * k_6), k_7, t + c7 * h);
-
-        DeterministicStateType yn = y + h * (b1 * k_1 + b3 * k_3 + b4 * k_4 + b5 * k_5 + b6 * k_6);
-        DeterministicStateType ynstar = y + h * (b1p * k_1 + b3p * k_3 + b4p * k_4 + b5p * k_5 + b6p * k_6 + b7p * k_7);
-        DeterministicStateType diff = yn + (-1 * ynstar);
-        double error = 0;
-        for (auto &p : diff.getMap())
+        //The last step is shortened to end on T_MAX.
+        bool last = t + h >= T_MAX;
+        if (last)
+            h = T_MAX - t;
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a21 * k_1[i]);
+        system(stage, k_2, t + c2 * h);
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a31 * k_1[i] + a32 * k_2[i]);
+        system(stage, k_3, t + c3 * h);
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a41 * k_1[i] + a42 * k_2[i] + a43 * k_3[i]);
+        system(stage, k_4, t + c4 * h);
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a51 * k_1[i] + a52 * k_2[i] + a53 * k_3[i] + a54 * k_4[i]);
+        system(stage, k_5, t + c5 * h);
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a61 * k_1[i] + a62 * k_2[i] + a63 * k_3[i] + a64 * k_4[i] + a65 * k_5[i]);
+        system(stage, k_6, t + c6 * h);
+        //The seventh stage is the fifth order solution itself.
+        for (int i = 0; i < n; i++)
+            stage[i] = y[i] + h * (a71 * k_1[i] + a73 * k_3[i] + a74 * k_4[i] + a75 * k_5[i] + a76 * k_6[i]);
+        system(stage, k_7, t + c7 * h);
+
+        std::fill(lane_errors.begin(), lane_errors.end(), 0);
+        for (int i = 0; i < n; i += lanes)
         {
-            error += (p.second * p.second);
+            for (int b = 0; b < lanes; b++)
+            {
+                double difference = h * (e1 * k_1[i + b] + e3 * k_3[i + b] + e4 * k_4[i + b] + e5 * k_5[i + b] + e6 * k_6[i + b] + e7 * k_7[i + b]);
+                lane_errors[b] += (difference * difference);
+            }
         }
+        double error = *std::max_element(lane_errors.begin(), lane_errors.end());
         error = pow(error, 0.5);
 
         double delta = 0.84 * pow(tol / error, (1.0 / 5.0));
 
         if (error < tol)
         {
-            mpSerialiser->serialise(t, y.getMap());
-            t += h;
-            y += h * (b1 * k_1 + b3 * k_3 + b4 * k_4 + b5 * k_5 + b6 * k_6);
+            observer(y, t, last ? T_MAX : t + h);
+            t = last ? T_MAX : t + h;
+            std::swap(y, stage);
+            std::swap(k_1, k_7);
+            //A compartment decaying towards zero eventually underflows to subnormal numbers, which
+            //are many times slower to compute with than zero.
+            for (int i = 0; i < n; i++)
+            {
+                if (std::fabs(y[i]) < std::numeric_limits<double>::min())
+                    y[i] = 0;
+            }
+            if (lanes == 1 && stopEarly(t, &y[0]))
+                break;
         }
 
         if (delta <= 0.1)
@@ -394,28 +960,541 @@ void MarkovChain::solveRKD5()
         }
     }
 
-    mpSerialiser->serialiseFinally(t, y.getMap());
+    return (t);
+}
+
+void MarkovChain::solveRKD5()
+{
+    DeterministicStateType y(toStateVector(states), mStateNames);
+    mpSerialiser->serialiseHeader(mStateIndex);
+    double t = integrateRKD5(y, mStartTime, std::bind(&MarkovChain::derivative, this, pl::_1, pl::_2, pl::_3),
+                             std::bind(&MarkovChain::serialiserDeterministic, this, pl::_1, pl::_2, pl::_3));
+    serialiserDeterministic(y, t, endTime(t));
+    recordEnd(&y[0]);
+    mpSerialiser->serialiseFinally(endTime(t), &y[0]);
+}
+
+//Forward sensitivity equations. Block k of z holds s_k = dx/dtheta_k, and
+//ds_k/dt = S^T (dR/dx s_k + dR/dtheta_k), so every block reuses the rate gradients of the state block,
+//and the unit rates behind dR/dtheta are evaluated once for all the parameters.
+void MarkovChain::sensitivityDerivative(const DeterministicStateType &z, DeterministicStateType &dzdt, const double t)
+{
+    int n = mStateIndex.size();
+    const state_vector &values = z.getValues();
+    dzdt.resize(z);
+    std::copy(values.begin(), values.begin() + n, mStiffStates.begin());
+
+    for (int j = 0; j < transitions.size(); j++)
+    {
+        mPropensities[j] = transitions[j]->getRate(mStiffStates);
+        transitions[j]->getRateGradient(mStiffStates, mRateGradients[j]);
+    }
+    mStoichiometry.multiplyTransposed(mPropensities.data(), &dzdt[0]);
+    for (int j : mSensitivityTransitions)
+        mUnitRates[j] = transitions[j]->getUnitRate(mStiffStates);
+
+    for (int k = 0; k < mSensitivityRateTerms.size(); k++)
+    {
+        const double *sensitivity = values.data() + n * (k + 1);
+        for (int j = 0; j < transitions.size(); j++)
+        {
+            double rate = 0;
+            for (auto &partial : mRateGradients[j])
+                rate += partial.second * sensitivity[partial.first];
+            mSensitivityRates[j] = rate;
+        }
+        for (auto &term : mSensitivityRateTerms[k])
+            mSensitivityRates[term.first] += term.second * mUnitRates[term.first];
+        mStoichiometry.multiplyTransposed(mSensitivityRates.data(), &dzdt[n * (k + 1)]);
+    }
+}
+
+void MarkovChain::serialiserSensitivity(const DeterministicStateType &z, const double t, const double next_t)
+{
+    int n = mStateIndex.size();
+    const state_vector &values = z.getValues();
+    if (needsState(mpSerialiser, next_t))
+        mpSerialiser->serialise(t, values.data());
+    for (int k = 0; k < mSensitivitySerialisers.size(); k++)
+    {
+        if (needsState(mSensitivitySerialisers[k], next_t))
+            mSensitivitySerialisers[k]->serialise(t, values.data() + n * (k + 1));
+    }
+}
+
+void MarkovChain::solveSensitivities(std::vector<Serialiser *> serialisers)
+{
+    if (!mCompiled)
+        compile();
+    if (serialisers.size() != mSensitivityParameters.size())
+    {
+        *mpLog << "Expected " << mSensitivityParameters.size() << " sensitivity serialisers, got " << serialisers.size() << std::endl;
+        return;
+    }
+    mSensitivitySerialisers = serialisers;
+    mStoppingTime = std::numeric_limits<double>::infinity();
+
+    std::map<Transition *, int> transition_index;
+    for (int j = 0; j < transitions.size(); j++)
+        transition_index[transitions[j]] = j;
+    mSensitivityRateTerms.assign(mSensitivityParameters.size(), std::vector<std::pair<int, double>>());
+    mSensitivityTransitions.clear();
+    for (int k = 0; k < mSensitivityTerms.size(); k++)
+    {
+        for (auto &term : mSensitivityTerms[k])
+        {
+            std::map<Transition *, int>::iterator it = transition_index.find(term.first);
+            if (it != transition_index.end())
+            {
+                mSensitivityRateTerms[k].push_back(std::make_pair(it->second, term.second));
+                mSensitivityTransitions.push_back(it->second);
+            }
+        }
+    }
+    std::sort(mSensitivityTransitions.begin(), mSensitivityTransitions.end());
+    mSensitivityTransitions.erase(std::unique(mSensitivityTransitions.begin(), mSensitivityTransitions.end()), mSensitivityTransitions.end());
+
+    int n = mStateIndex.size();
+    mStiffStates.assign(n, 0);
+    mRateGradients.assign(transitions.size(), std::vector<std::pair<int, double>>());
+    mSensitivityRates.assign(transitions.size(), 0);
+    mUnitRates.assign(transitions.size(), 0);
+
+    //The initial state does not depend on the parameters.
+    state_vector initial_values = toStateVector(states);
+    initial_values.resize(n * (mSensitivityParameters.size() + 1), 0);
+    DeterministicStateType z(initial_values, Deterministic::State::Names());
+
+    mpSerialiser->serialiseHeader(mStateIndex);
+    for (Serialiser *pSerialiser : mSensitivitySerialisers)
+        pSerialiser->serialiseHeader(mStateIndex);
+
+    double t = integrateRKD5(z, mStartTime, std::bind(&MarkovChain::sensitivityDerivative, this, pl::_1, pl::_2, pl::_3),
+                             std::bind(&MarkovChain::serialiserSensitivity, this, pl::_1, pl::_2, pl::_3));
+    serialiserSensitivity(z, t, endTime(t));
+
+    const state_vector &values = z.getValues();
+    recordEnd(values.data());
+    mpSerialiser->serialiseFinally(endTime(t), values.data());
+    for (int k = 0; k < mSensitivitySerialisers.size(); k++)
+        mSensitivitySerialisers[k]->serialiseFinally(endTime(t), values.data() + n * (k + 1));
+}
+
+//Dormand-Prince on several chains at once. The chains must have the same states and transitions,
+//differing only in parameters, as when one model is set up with many parameter sets. They are
+//integrated Transition::BATCH_LANES at a time, with states stored lane-innermost (state i of lane b
+//at i * BATCH_LANES + b), so built-in rates, the stoichiometry product and the Runge-Kutta updates
+//all run as fixed-width loops over the lanes. Each block shares one step size, set by its worst lane,
+//so neighbouring parameter sets should be passed together. Custom rates are evaluated lane by lane,
+//by each chain's own transition. Chains that differ in structure, start time or max time are solved
+//one at a time instead.
+void MarkovChain::solveBatch(std::vector<MarkovChain *> chains)
+{
+    if (chains.empty())
+        return;
+    for (MarkovChain *pChain : chains)
+    {
+        if (!pChain->mCompiled)
+            pChain->compile();
+    }
+
+    MarkovChain &first = *chains[0];
+    const int lanes = Transition::BATCH_LANES;
+    const int n = first.mStateIndex.size();
+    const int num_transitions = first.transitions.size();
+
+    bool same_structure = true;
+    for (MarkovChain *pChain : chains)
+    {
+        same_structure = same_structure && pChain->mStateIndex == first.mStateIndex && pChain->transitions.size() == num_transitions;
+        for (int j = 0; same_structure && j < num_transitions; j++)
+        {
+            Transition *pTransition = pChain->transitions[j];
+            same_structure = pTransition->getSourceIndex() == first.transitions[j]->getSourceIndex() &&
+                             pTransition->getDestinationIndex() == first.transitions[j]->getDestinationIndex() &&
+                             pTransition->getRateDependencies() == first.transitions[j]->getRateDependencies();
+        }
+    }
+    //Lanes share their steps, so they must also cover the same time span.
+    bool same_times = true;
+    for (MarkovChain *pChain : chains)
+        same_times = same_times && pChain->mStartTime == first.mStartTime && pChain->T_MAX == first.T_MAX;
+    if (!same_structure || !same_times)
+    {
+        *first.mpLog << "Chains differ in " << (same_structure ? "start or max time" : "structure") << ", so are solved one at a time" << std::endl;
+        for (MarkovChain *pChain : chains)
+            pChain->solve(SOLVER_TYPE_RKD5);
+        return;
+    }
+
+    state_vector parameters(num_transitions * lanes);
+    state_vector rates(num_transitions * lanes);
+    state_vector initial_values(n * lanes);
+    std::vector<state_vector> lane_states(lanes, state_vector(n));
+    for (int start = 0; start < chains.size(); start += lanes)
+    {
+        //A short last block is padded with copies of its last chain, which are integrated but not
+        //serialised.
+        const int used = std::min<int>(lanes, chains.size() - start);
+        std::vector<MarkovChain *> block(lanes, chains[start + used - 1]);
+        std::copy(chains.begin() + start, chains.begin() + start + used, block.begin());
+
+        for (int j = 0; j < num_transitions; j++)
+        {
+            for (int b = 0; b < lanes; b++)
+                parameters[j * lanes + b] = block[b]->transitions[j]->getRateParameter();
+        }
+        for (int b = 0; b < lanes; b++)
+        {
+            state_vector lane_values = block[b]->toStateVector(block[b]->states);
+            for (int i = 0; i < n; i++)
+                initial_values[i * lanes + b] = lane_values[i];
+        }
+        DeterministicStateType y(initial_values, Deterministic::State::Names());
+
+        auto gatherLanes = [&](const state_vector &values) {
+            for (int b = 0; b < lanes; b++)
+            {
+                for (int i = 0; i < n; i++)
+                    lane_states[b][i] = values[i * lanes + b];
+            }
+        };
+
+        auto system = [&](const DeterministicStateType &x, DeterministicStateType &dxdt, const double t) {
+            const state_vector &values = x.getValues();
+            dxdt.resize(x);
+            bool gathered = false;
+            for (int j = 0; j < num_transitions; j++)
+            {
+                double *rate = &rates[j * lanes];
+                if (first.transitions[j]->getUnitRates(values.data(), rate))
+                {
+                    const double *parameter = &parameters[j * lanes];
+                    for (int b = 0; b < lanes; b++)
+                        rate[b] *= parameter[b];
+                    continue;
+                }
+                if (!gathered)
+                {
+                    gatherLanes(values);
+                    gathered = true;
+                }
+                for (int b = 0; b < lanes; b++)
+                    rate[b] = block[b]->transitions[j]->getRate(lane_states[b]);
+            }
+
+            dxdt.fill(0);
+            double *derivatives = &dxdt[0];
+            for (int j = 0; j < num_transitions; j++)
+            {
+                double rate[lanes];
+                std::copy(&rates[j * lanes], &rates[j * lanes] + lanes, rate);
+                for (int k = first.mStoichiometry.rowBegin(j); k < first.mStoichiometry.rowEnd(j); k++)
+                {
+                    double change = first.mStoichiometry.getValue(k);
+                    double *derivative = derivatives + first.mStoichiometry.getColumn(k) * lanes;
+                    for (int b = 0; b < lanes; b++)
+                        derivative[b] += change * rate[b];
+                }
+            }
+            for (int i = 0; i < n * lanes; i++)
+            {
+                if (std::fabs(derivatives[i]) < std::numeric_limits<double>::min())
+                    derivatives[i] = 0;
+            }
+        };
+
+        auto observer = [&](const DeterministicStateType &x, const double t, const double next_t) {
+            bool gathered = false;
+            for (int b = 0; b < used; b++)
+            {
+                if (!needsState(block[b]->mpSerialiser, next_t))
+                    continue;
+                if (!gathered)
+                {
+                    gatherLanes(x.getValues());
+                    gathered = true;
+                }
+                block[b]->mpSerialiser->serialise(t, lane_states[b].data());
+            }
+        };
+
+        for (int b = 0; b < used; b++)
+        {
+            block[b]->mStoppingTime = std::numeric_limits<double>::infinity();
+            block[b]->mpSerialiser->serialiseHeader(block[b]->mStateIndex);
+        }
+        double t = first.integrateRKD5(y, first.mStartTime, system, observer, lanes);
+        gatherLanes(y.getValues());
+        for (int b = 0; b < used; b++)
+        {
+            if (needsState(block[b]->mpSerialiser, block[b]->endTime(t)))
+                block[b]->mpSerialiser->serialise(t, lane_states[b].data());
+            block[b]->recordEnd(lane_states[b].data());
+            block[b]->mpSerialiser->serialiseFinally(block[b]->endTime(t), lane_states[b].data());
+        }
+    }
 }
 
 void MarkovChain::solveForwardEuler()
 {
-    DeterministicStateType y0(states);
+    DeterministicStateType y0(toStateVector(states), mStateNames);
 
-    double t = 0;
+    double t = mStartTime;
     double h = 1.0 / 120.0;
-    mpSerialiser->serialiseHeader(y0.getMap());
+    mpSerialiser->serialiseHeader(mStateIndex);
+    const int n = y0.size();
+    DeterministicStateType dpdt(y0);
     while (t < T_MAX)
     {
-        mpSerialiser->serialise(t, y0.getMap());
-        DeterministicStateType dpdt;
+        if (stopEarly(t, &y0[0]))
+            break;
+        //The last step is shortened to end on T_MAX.
+        double step = std::min(h, T_MAX - t);
+        serialiserDeterministic(y0, t, std::min(t + step, T_MAX));
         derivative(y0, dpdt, t);
-        //std::cout << y0.getMap()["S"] << std::endl;
-        y0 += h * dpdt;
+        for (int i = 0; i < n; i++)
+            y0[i] += step * dpdt[i];
 
-        t += h;
+        t = std::min(t + step, T_MAX);
+    }
+    serialiserDeterministic(y0, t, endTime(t));
+
+    recordEnd(&y0[0]);
+    mpSerialiser->serialiseFinally(endTime(t), &y0[0]);
+}
+
+void MarkovChain::stiffDerivative(const StiffStateType &x, StiffStateType &dxdt, const double t)
+{
+    std::copy(x.begin(), x.end(), mStiffStates.begin());
+    for (int i = 0; i < transitions.size(); i++)
+    {
+        mPropensities[i] = transitions[i]->getRate(mStiffStates);
+    }
+    mStoichiometry.multiplyTransposed(mPropensities.data(), &dxdt[0]);
+}
+
+//J = S^T * dR/dx. Each transition supplies the gradient of its rate, which the stoichiometry row
+//spreads over the states the transition changes. The system is autonomous, so df/dt is zero.
+void MarkovChain::stiffJacobian(const StiffStateType &x, StiffMatrixType &J, const double &t, StiffStateType &dfdt)
+{
+    std::copy(x.begin(), x.end(), mStiffStates.begin());
+    J.clear();
+    dfdt.clear();
+    for (int j = 0; j < transitions.size(); j++)
+    {
+        transitions[j]->getRateGradient(mStiffStates, mRateGradient);
+        for (auto &partial : mRateGradient)
+        {
+            for (int k = mStoichiometry.rowBegin(j); k < mStoichiometry.rowEnd(j); k++)
+                J(mStoichiometry.getColumn(k), partial.first) += mStoichiometry.getValue(k) * partial.second;
+        }
+    }
+}
+
+void MarkovChain::serialiserStiff(const StiffStateType &x, const double t, const double next_t)
+{
+    if (needsState(mpSerialiser, next_t))
+        mpSerialiser->serialise(t, &x[0]);
+}
+
+//Linearly implicit Rosenbrock method of order 4 from odeint, with step size control. Stable on the
+//slow demographic timescales where the explicit integrators are held to tiny steps.
+void MarkovChain::solveRosenbrock()
+{
+    mStiffStates = toStateVector(states);
+    StiffStateType x(mStiffStates.size());
+    std::copy(mStiffStates.begin(), mStiffStates.end(), x.begin());
+
+    mpSerialiser->serialiseHeader(mStateIndex);
+    auto steps = make_adaptive_time_range(make_controlled(1e-10, 1e-6, rosenbrock4<double>()),
+                                          std::make_pair(std::bind(&MarkovChain::stiffDerivative, this, pl::_1, pl::_2, pl::_3),
+                                                         std::bind(&MarkovChain::stiffJacobian, this, pl::_1, pl::_2, pl::_3, pl::_4)),
+                                          x, mStartTime, T_MAX, 0.1);
+    //As in solveDeterministic, each point waits for the time of the next.
+    double t = T_MAX;
+    double previous_t = mStartTime;
+    StiffStateType previous(x);
+    for (auto step = steps.first; step != steps.second; ++step)
+    {
+        if (step->second > previous_t)
+            serialiserStiff(previous, previous_t, step->second);
+        previous_t = step->second;
+        previous = step->first;
+        if (stopEarly(step->second, &step->first[0]))
+        {
+            t = step->second;
+            break;
+        }
+    }
+    serialiserStiff(previous, previous_t, endTime(t));
+
+    std::copy(x.begin(), x.end(), mStiffStates.begin());
+    recordEnd(mStiffStates.data());
+    mpSerialiser->serialiseFinally(endTime(t), mStiffStates.data());
+}
+
+//Pseudo-transient continuation: damped Newton steps on f(x) = 0, with (I/dtau - J) dx = f, where
+//the pseudo time step dtau grows as the residual falls (switched evolution relaxation). Early steps
+//follow the dynamics towards the attracting equilibrium, and later steps are plain Newton.
+bool MarkovChain::findEquilibrium(std::vector<std::string> held_states, int max_iterations, double tolerance)
+{
+    using namespace boost::numeric::ublas;
+
+    if (!mCompiled)
+        compile();
+    int n = mStateIndex.size();
+
+    std::vector<bool> held(n, false);
+    for (const std::string &state : held_states)
+    {
+        state_index::const_iterator it = mStateIndex.find(state);
+        if (it != mStateIndex.end())
+            held[it->second] = true;
     }
+    for (Transition *pTransition : transitions)
+    {
+        for (const std::string &counter : pTransition->getCounters())
+        {
+            state_index::const_iterator it = mStateIndex.find(counter);
+            if (it != mStateIndex.end())
+                held[it->second] = true;
+        }
+    }
+
+    state_vector initial_states = toStateVector(states);
+    StiffStateType x(n), f(n), dfdt(n), step(n);
+    StiffMatrixType J(n, n), A(n, n);
+    mStiffStates.assign(n, 0);
+    for (int i = 0; i < n; i++)
+        x(i) = held[i] ? 0 : initial_states[i];
+
+    double pseudo_step = 1;
+    double previous_residual = -1;
+    for (int iteration = 0; iteration < max_iterations; iteration++)
+    {
+        stiffDerivative(x, f, 0);
+        double residual = 0;
+        double scale = 1;
+        for (int i = 0; i < n; i++)
+        {
+            if (held[i])
+                continue;
+            residual = std::max(residual, std::fabs(f(i)));
+            scale = std::max(scale, std::fabs(x(i)));
+        }
+
+        if (residual <= tolerance * scale)
+        {
+            mEquilibriumSlots.clear();
+            for (auto &state : states)
+            {
+                int slot = mStateIndex[state.first];
+                if (held[slot])
+                    continue;
+                state.second = x(slot);
+                mEquilibriumSlots.push_back(slot);
+            }
+            if (verbose)
+                *mpLog << "Equilibrium found after " << iteration << " iterations" << std::endl;
+            return (true);
+        }
+
+        if (previous_residual > 0)
+            pseudo_step = std::min(pseudo_step * previous_residual / residual, 1e12);
+        previous_residual = residual;
+
+        stiffJacobian(x, J, 0, dfdt);
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+                A(i, j) = held[i] ? (i == j) : (i == j) / pseudo_step - J(i, j);
+            step(i) = held[i] ? 0 : f(i);
+        }
+
+        permutation_matrix<std::size_t> pivots(n);
+        if (lu_factorize(A, pivots) != 0)
+        {
+            *mpLog << "Equilibrium search stopped: singular Jacobian at iteration " << iteration << std::endl;
+            return (false);
+        }
+        lu_substitute(A, pivots, step);
+
+        for (int i = 0; i < n; i++)
+            x(i) = std::max(x(i) + step(i), 0.0);
+    }
+
+    *mpLog << "No equilibrium found within " << max_iterations << " iterations" << std::endl;
+    return (false);
+}
+
+void MarkovChain::setDrawInitialStates(bool status)
+{
+    mDrawInitialStates = status;
+}
 
-    mpSerialiser->serialiseFinally(t, y0.getMap());
+void MarkovChain::drawInitialStates(state_vector &current_states)
+{
+    if (!mDrawInitialStates)
+        return;
+    for (int slot : mEquilibriumSlots)
+    {
+        if (current_states[slot] > 0)
+            current_states[slot] = boost::random::poisson_distribution<int, double>(current_states[slot])(mGenerator);
+    }
+}
+
+void MarkovChain::addSensitivity(std::string parameter, Transition *transition, double rate_derivative)
+{
+    std::vector<std::string>::iterator it = std::find(mSensitivityParameters.begin(), mSensitivityParameters.end(), parameter);
+    int k = it - mSensitivityParameters.begin();
+    if (it == mSensitivityParameters.end())
+    {
+        mSensitivityParameters.push_back(parameter);
+        mSensitivityTerms.push_back(std::vector<std::pair<Transition *, double>>());
+    }
+    mSensitivityTerms[k].push_back(std::make_pair(transition, rate_derivative));
+}
+
+std::vector<std::string> MarkovChain::getSensitivityParameters() const
+{
+    return (mSensitivityParameters);
+}
+
+double MarkovChain::getRateGradientError()
+{
+    if (!mCompiled)
+        compile();
+    state_vector values = toStateVector(states);
+    state_vector perturbed = values;
+    state_vector gradient(values.size());
+    double worst = 0;
+    for (Transition *pTransition : transitions)
+    {
+        std::fill(gradient.begin(), gradient.end(), 0);
+        pTransition->getRateGradient(values, mRateGradient);
+        for (auto &partial : mRateGradient)
+            gradient[partial.first] += partial.second;
+
+        std::vector<int> dependencies = pTransition->getRateDependencies();
+        std::sort(dependencies.begin(), dependencies.end());
+        dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+        for (int i : dependencies)
+        {
+            double step = 1e-5 * std::max(std::fabs(values[i]), 1.0);
+            perturbed[i] = values[i] + step;
+            double rate_up = pTransition->getRate(perturbed);
+            perturbed[i] = values[i] - step;
+            double rate_down = pTransition->getRate(perturbed);
+            perturbed[i] = values[i];
+
+            double difference = (rate_up - rate_down) / (2 * step);
+            double scale = std::max(std::fabs(difference), std::fabs(gradient[i]));
+            if (scale > 0)
+                worst = std::max(worst, std::fabs(difference - gradient[i]) / scale);
+        }
+    }
+    return (worst);
 }
 
 void MarkovChain::setDebug()
@@ -423,25 +1502,42 @@ void MarkovChain::setDebug()
     debug = true;
 }
 
+void MarkovChain::setLog(std::ostream *log)
+{
+    mpLog = log;
+}
+
+void MarkovChain::setVerbose(bool status)
+{
+    verbose = status;
+}
+
 void MarkovChain::setSerialiser(Serialiser *serialiser)
 {
     mpSerialiser = serialiser;
 }
 
+void MarkovChain::setEventLog(EventLogWriter *event_log)
+{
+    mpEventLog = event_log;
+}
+
 void MarkovChain::addState(std::string state_name, double initial_value)
 {
     states[state_name] = initial_value;
+    mCompiled = false;
 }
 
 void MarkovChain::addTransition(Transition *transition)
 {
-    if (true)
+    if (verbose)
     {
         double two_decimals = round(100 / transition->getSingleParameter()) / 100;
-        std::cout << ("Adding transition from " + transition->getSourceState() + " to " + transition->getDestinationState() + " at rate " + std::to_string(transition->getSingleParameter()) + " (1/") << std::setprecision(2) << std::fixed << two_decimals << ")" << std::endl;
+        *mpLog << ("Adding transition from " + transition->getSourceState() + " to " + transition->getDestinationState() + " at rate " + std::to_string(transition->getSingleParameter()) + " (1/") << std::setprecision(2) << std::fixed << two_decimals << ")" << std::endl;
     }
 
     transitions.push_back(transition);
+    mCompiled = false;
     if (transition->getNumCounters() > 0)
     {
         for (std::string counter : transition->getCounters())
@@ -456,21 +1552,338 @@ void MarkovChain::setMaxTime(double newMaxTime)
     T_MAX = newMaxTime;
 }
 
+void MarkovChain::compile()
+{
+    mStateIndex.clear();
+    std::shared_ptr<std::vector<std::string>> names = std::make_shared<std::vector<std::string>>();
+    int slot = 0;
+    for (auto &state : states)
+    {
+        mStateIndex[state.first] = slot++;
+        names->push_back(state.first);
+    }
+    mStateNames = names;
+
+    mStoichiometry.clear(mStateIndex.size());
+    for (Transition *pTransition : transitions)
+    {
+        pTransition->compile(mStateIndex);
+        mStoichiometry.addRow(pTransition->getStoichiometry());
+    }
+    mPropensities.assign(transitions.size(), 0);
+    mEndStates.clear();
+    for (StoppingCondition &condition : mStoppingConditions)
+    {
+        condition.indices.clear();
+        for (const std::string &state : condition.states)
+        {
+            state_index::const_iterator it = mStateIndex.find(state);
+            if (it != mStateIndex.end())
+                condition.indices.push_back(it->second);
+        }
+    }
+    mCompiled = true;
+}
+
 void MarkovChain::solve(int solver_type)
 {
+    if (!mCompiled)
+        compile();
+    mStoppingTime = std::numeric_limits<double>::infinity();
+    //Only a stochastic run can continue a restored generator: a deterministic run after a restore uses
+    //it up, so the next stochastic run draws from its own stream as usual.
+    if (!isStochastic(solver_type))
+        mResumeGenerator = false;
+
     if (solver_type == SOLVER_TYPE_GILLESPIE)
     {
         solveGillespie();
     }
+    else if (solver_type == SOLVER_TYPE_NEXT_REACTION)
+    {
+        solveNextReaction();
+    }
+    else if (solver_type == SOLVER_TYPE_TAU_LEAP)
+    {
+        solveTauLeap();
+    }
+    else if (solver_type == SOLVER_TYPE_HYBRID)
+    {
+        solveHybrid();
+    }
+    else if (solver_type == SOLVER_TYPE_RK4)
+    {
+        solveRK4();
+    }
+    else if (solver_type == SOLVER_TYPE_FORWARD_EULER)
+    {
+        solveForwardEuler();
+    }
+    else if (solver_type == SOLVER_TYPE_CASH_KARP)
+    {
+        solveDeterministic();
+    }
+    else if (solver_type == SOLVER_TYPE_ROSENBROCK)
+    {
+        solveRosenbrock();
+    }
     else
     {
         solveRKD5();
     }
 }
 
-void MarkovChain::setSeed(double newSeed)
+bool MarkovChain::isStochastic(int solver_type)
+{
+    return (solver_type < 0);
+}
+
+//Each (seed, realisation) pair selects its own Philox stream.
+void MarkovChain::setSeed(uint64_t newSeed, uint64_t newRealisation)
 {
     seed = newSeed;
+    realisation = newRealisation;
+}
+
+void MarkovChain::setTauLeapEpsilon(double epsilon)
+{
+    mTauLeapEpsilon = epsilon;
+}
+
+void MarkovChain::setHybridStepSize(double step_size)
+{
+    mHybridStepSize = step_size;
+}
+
+void MarkovChain::setHybridThresholds(double rate_threshold, double population_threshold)
+{
+    mHybridRateThreshold = rate_threshold;
+    mHybridPopulationThreshold = population_threshold;
+}
+
+void MarkovChain::addStoppingCondition(std::vector<std::string> states, double threshold, bool above)
+{
+    StoppingCondition condition;
+    condition.states = states;
+    condition.threshold = threshold;
+    condition.above = above;
+    mStoppingConditions.push_back(condition);
+    mCompiled = false;
+}
+
+double MarkovChain::getStoppingTime() const
+{
+    return (mStoppingTime);
+}
+
+//True, recording t as the stopping time, if any stopping condition holds for values in slot order.
+bool MarkovChain::stopEarly(double t, const double *values)
+{
+    for (const StoppingCondition &condition : mStoppingConditions)
+    {
+        double total = 0;
+        for (int i : condition.indices)
+            total += values[i];
+        if (condition.above ? total >= condition.threshold : total <= condition.threshold)
+        {
+            mStoppingTime = t;
+            return (true);
+        }
+    }
+    return (false);
+}
+
+//A run holds each of its states until the next event or step, next_t. The serialiser needs the state
+//only if next_t is past its next output time: the state is then either the last one before that time
+//or the first one after it. Every other state can go without being converted or copied.
+bool MarkovChain::needsState(const Serialiser *pSerialiser, double next_t)
+{
+    return (next_t > pSerialiser->getNextTime());
+}
+
+void MarkovChain::serialiseState(double t, double next_t, const state_vector &values)
+{
+    if (needsState(mpSerialiser, next_t))
+        mpSerialiser->serialise(t, values.data());
+}
+
+//The time to hand to serialiseFinally. A run that ended before T_MAX, because a stopping condition
+//held or nothing more could happen, keeps its last state: finishing just past T_MAX makes the
+//serialiser carry that state over every remaining output time, T_MAX included.
+double MarkovChain::endTime(double t) const
+{
+    if (t <= T_MAX)
+        return (std::nextafter(T_MAX, std::numeric_limits<double>::infinity()));
+    return (t);
+}
+
+//Each realisation draws from its own (seed, realisation) stream. The first one after a checkpoint was
+//restored instead continues the generator saved with it, and starts from its states as they are.
+void MarkovChain::startRealisation(state_vector &current_states)
+{
+    if (mResumeGenerator)
+    {
+        mResumeGenerator = false;
+        return;
+    }
+    mGenerator.seed(seed, realisation);
+    if (!mFromCheckpoint)
+        drawInitialStates(current_states);
+}
+
+//Keeps the final state of a run, in slot order, for getCheckpoint. Unless a stopping condition ended
+//it, a run ends at T_MAX, whenever its last event was.
+void MarkovChain::recordEnd(const double *values)
+{
+    mEndTime = std::isinf(mStoppingTime) ? std::max(T_MAX, mStartTime) : mStoppingTime;
+    mEndStates.assign(values, values + mStateIndex.size());
+}
+
+//A checkpoint is laid out as the magic bytes and format version, the time, the generator state, the
+//number of states, then each state's name length, name and value. Numbers are in native byte order.
+namespace
+{
+const char CHECKPOINT_MAGIC[] = {'M', 'C', 'C', 'P'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+template <typename T>
+void appendBytes(std::string &buffer, const T &value)
+{
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readBytes(const std::string &buffer, size_t &offset, T &value)
+{
+    if (offset + sizeof(T) > buffer.size())
+        return (false);
+    std::memcpy(&value, buffer.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return (true);
+}
+}
+
+std::string MarkovChain::getCheckpoint() const
+{
+    std::string checkpoint;
+    if (mEndStates.empty())
+        return (checkpoint);
+    checkpoint.append(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    appendBytes(checkpoint, CHECKPOINT_VERSION);
+    appendBytes(checkpoint, mEndTime);
+    appendBytes(checkpoint, mGenerator.getState());
+    appendBytes(checkpoint, (uint32_t)mStateIndex.size());
+    for (auto &entry : mStateIndex)
+    {
+        appendBytes(checkpoint, (uint32_t)entry.first.size());
+        checkpoint.append(entry.first);
+        appendBytes(checkpoint, mEndStates[entry.second]);
+    }
+    return (checkpoint);
+}
+
+double MarkovChain::getCheckpointTime(const std::string &checkpoint)
+{
+    size_t offset = sizeof(CHECKPOINT_MAGIC);
+    uint32_t version = 0;
+    double time = std::numeric_limits<double>::quiet_NaN();
+    if (checkpoint.compare(0, sizeof(CHECKPOINT_MAGIC), CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 ||
+        !readBytes(checkpoint, offset, version) || version != CHECKPOINT_VERSION || !readBytes(checkpoint, offset, time))
+        return (std::numeric_limits<double>::quiet_NaN());
+    return (time);
+}
+
+bool MarkovChain::restoreCheckpoint(const std::string &checkpoint, std::vector<std::string> held_states)
+{
+    size_t offset = sizeof(CHECKPOINT_MAGIC) + sizeof(CHECKPOINT_VERSION);
+    double time = getCheckpointTime(checkpoint);
+    RandomNumberGenerator::State generator;
+    uint32_t num_states = 0;
+    bool valid = !std::isnan(time) && readBytes(checkpoint, offset, time) && readBytes(checkpoint, offset, generator) &&
+                 readBytes(checkpoint, offset, num_states);
+
+    state_values values;
+    for (uint32_t i = 0; valid && i < num_states; i++)
+    {
+        uint32_t length = 0;
+        double value = 0;
+        valid = readBytes(checkpoint, offset, length) && offset + length <= checkpoint.size();
+        if (!valid)
+            break;
+        std::string name = checkpoint.substr(offset, length);
+        offset += length;
+        valid = readBytes(checkpoint, offset, value);
+        values[name] = value;
+    }
+    if (!valid)
+    {
+        *mpLog << "Checkpoint is malformed" << std::endl;
+        return (false);
+    }
+
+    for (auto &entry : values)
+    {
+        state_values::iterator it = states.find(entry.first);
+        if (it != states.end() && std::find(held_states.begin(), held_states.end(), entry.first) == held_states.end())
+            it->second = entry.second;
+    }
+    mStartTime = time;
+    mFromCheckpoint = true;
+    mGenerator.setState(generator);
+    mResumeGenerator = true;
+    return (true);
+}
+
+bool MarkovChain::forkCheckpoint(const std::string &checkpoint, uint64_t branch, std::vector<std::string> held_states)
+{
+    if (!restoreCheckpoint(checkpoint, held_states))
+        return (false);
+    mGenerator.fork(branch);
+    return (true);
+}
+
+//Events are replayed onto the keyframe's states with the transitions that fired them, so the states
+//passed on are those the run passed to its own serialiser, and are exact.
+bool MarkovChain::replayEventLog(const std::string &filename, Serialiser *serialiser, double from_time)
+{
+    if (!mCompiled)
+        compile();
+    EventLogReader reader(filename);
+    if (!reader.good() || reader.getNames() != *mStateNames)
+    {
+        *mpLog << "Event log " << filename << " does not match the chain's states" << std::endl;
+        return (false);
+    }
+    double t = 0;
+    state_vector current_states;
+    if (!reader.seek(from_time, t, current_states))
+    {
+        *mpLog << "Event log " << filename << " has no initial states" << std::endl;
+        return (false);
+    }
+
+    serialiser->serialiseHeader(mStateIndex);
+    double event_time = 0;
+    int eventOccurred = 0;
+    state_vector end_states;
+    while (reader.next(event_time, eventOccurred, end_states) && eventOccurred != EventLog::END)
+    {
+        if (eventOccurred >= transitions.size())
+        {
+            *mpLog << "Event log " << filename << " fires transition " << eventOccurred << ", which the chain does not have" << std::endl;
+            return (false);
+        }
+        if (needsState(serialiser, event_time))
+            serialiser->serialise(t, current_states.data());
+        t = event_time;
+        transitions[eventOccurred]->do_transition(t, current_states);
+    }
+    //A log whose run did not finish ends at its last event.
+    double end_time = eventOccurred == EventLog::END ? event_time : t;
+    if (needsState(serialiser, end_time))
+        serialiser->serialise(t, current_states.data());
+    serialiser->serialiseFinally(end_time, current_states.data());
+    return (true);
 }
 
 void MarkovChain::cleanup()
@@ -3,39 +3,58 @@
 
 #include <iostream>
 #include <utility>
+#include <string>
+#include <cstring>
 #include <vector>
 #include <assert.h>
 #include <cmath>
 #include <random>
 #include <numeric>
+#include <limits>
 #include <ctime>
 #include <iostream>
 #include <fstream>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_real_distribution.hpp>
 #include <boost/random.hpp>
+#include <boost/random/poisson_distribution.hpp>
 #include <boost/numeric/odeint.hpp>
+#include <boost/numeric/ublas/lu.hpp>
 #include <boost/operators.hpp>
 #include <functional>
+#include <memory>
 #include "StateValues.h"
 #include "Transitions.cpp"
 #include "Serialiser.hpp"
+#include "EventLog.hpp"
+#include "IndexedPriorityQueue.hpp"
+#include "PropensitySumTree.hpp"
+#include "StoichiometryMatrix.hpp"
+#include "Philox.hpp"
 
 namespace pl = std::placeholders;
 
 namespace Deterministic {
+//Values are held contiguously in the chain's compiled slot order, so the algebra below is a set of
+//flat loops. All states of a run share one list of names, which is only consulted when serialising.
 class State : boost::additive1<State,
                 boost::additive2<State, double, 
                     boost::multiplicative2<State, double> > >
 {
 public:
     using Map = std::map<std::string, double>;
-    State(Map const& map);
+    using Names = std::shared_ptr<const std::vector<std::string> >;
+    State(state_vector values, Names names);
     State() = default;
     State(const State &p) = default;
+    State(State &&p) = default;
     State &operator=(State const&a) = default;
+    State &operator=(State &&a) = default;
 
-    void addToKey(std::string key, double a);
+    double &operator[](int i) { return mValues[i]; }
+    double operator[](int i) const { return mValues[i]; }
+    const state_vector &getValues() const;
+    void fill(double a);
     State &operator+=(const State &p);
     State &operator+=(double a);
     State &operator*=(double f);
@@ -47,10 +66,13 @@ public:
     Map getMap() const;
 
 private:
-    Map mMap;
+    state_vector mValues;
+    Names mNames;
 };
 }
 
+//A chain and its transitions hold the scratch state of the run in progress, so one chain is solved by
+//one thread at a time. Ensembles build a chain per worker.
 class MarkovChain
 {
 private:
@@ -58,18 +80,93 @@ private:
     double T_MAX = 500;
     std::string filename;
     Serialiser *mpSerialiser;
+    EventLogWriter *mpEventLog = NULL;
     bool debug = false;
+    bool verbose = true;
+    std::ostream *mpLog = &std::cout;
 
-    unsigned long seed = mix(clock(), time(NULL), getpid());
+    uint64_t seed = mix(clock(), time(NULL), getpid());
+    uint64_t realisation = 0;
+    typedef PhiloxEngine RandomNumberGenerator;
+    RandomNumberGenerator mGenerator;
+    double runif();
 
+    state_index mStateIndex;
+    StoichiometryMatrix mStoichiometry;
+    state_vector mPropensities;
+    bool mCompiled = false;
+    Deterministic::State::Names mStateNames;
+    state_vector toStateVector(const state_values &state_values) const;
+
+    bool checkRate(int transition, double rate, const state_vector &current_states) const;
     void solveGillespie();
+    std::vector<std::vector<int>> buildDependencyGraph() const;
+    void solveNextReaction();
+    double mTauLeapEpsilon = 0.03;
+    void solveTauLeap();
+    double mHybridStepSize = 0.1;
+    double mHybridRateThreshold = 10;
+    double mHybridPopulationThreshold = 100;
+    void hybridDerivative(const state_vector &y, const std::vector<bool> &fast, state_vector &dydt, double &slow_rate);
+    //RK4 slopes and stage state for hybridStep, sized by solveHybrid.
+    state_vector mHybridSlopes[4];
+    state_vector mHybridStage;
+    void hybridStep(const state_vector &y, const std::vector<bool> &fast, double h, state_vector &y_next, double &integrated_slow_rate);
+    double findSlowCrossing(const state_vector &y, const std::vector<bool> &fast, double h, double integrated_slow_rate, double threshold, state_vector &y_next);
+    static void clampStates(state_vector &y);
+    void solveHybrid();
     using DeterministicStateType = Deterministic::State;
-    void derivative(const DeterministicStateType p, DeterministicStateType &dpdt, const double t);
-    void serialiserDeterministic(const DeterministicStateType &p, const double t);
+    void derivative(const DeterministicStateType &p, DeterministicStateType &dpdt, const double t);
+    void serialiserDeterministic(const DeterministicStateType &p, const double t, const double next_t);
     void solveDeterministic();
     void solveRK4();
+    typedef std::function<void(const DeterministicStateType &, DeterministicStateType &, const double)> DeterministicSystem;
+    typedef std::function<void(const DeterministicStateType &, const double, const double)> DeterministicObserver;
+    double integrateRKD5(DeterministicStateType &y, double t, DeterministicSystem system, DeterministicObserver observer, int lanes = 1);
     void solveRKD5();
     void solveForwardEuler();
+    typedef boost::numeric::ublas::vector<double> StiffStateType;
+    typedef boost::numeric::ublas::matrix<double> StiffMatrixType;
+    state_vector mStiffStates;
+    std::vector<std::pair<int, double>> mRateGradient;
+    void stiffDerivative(const StiffStateType &x, StiffStateType &dxdt, const double t);
+    void stiffJacobian(const StiffStateType &x, StiffMatrixType &J, const double &t, StiffStateType &dfdt);
+    void serialiserStiff(const StiffStateType &x, const double t, const double next_t);
+    void solveRosenbrock();
+    std::vector<int> mEquilibriumSlots;
+    bool mDrawInitialStates = false;
+    void drawInitialStates(state_vector &current_states);
+    std::vector<std::string> mSensitivityParameters;
+    std::vector<std::vector<std::pair<Transition *, double>>> mSensitivityTerms;
+    std::vector<std::vector<std::pair<int, double>>> mSensitivityRateTerms;
+    std::vector<std::vector<std::pair<int, double>>> mRateGradients;
+    state_vector mSensitivityRates;
+    //Transitions with a parameter in some sensitivity, and their unit rates at the current state.
+    std::vector<int> mSensitivityTransitions;
+    state_vector mUnitRates;
+    std::vector<Serialiser *> mSensitivitySerialisers;
+    void sensitivityDerivative(const DeterministicStateType &z, DeterministicStateType &dzdt, const double t);
+    void serialiserSensitivity(const DeterministicStateType &z, const double t, const double next_t);
+    struct StoppingCondition
+    {
+        std::vector<std::string> states;
+        std::vector<int> indices;
+        double threshold;
+        bool above;
+    };
+    std::vector<StoppingCondition> mStoppingConditions;
+    double mStoppingTime = std::numeric_limits<double>::infinity();
+    bool stopEarly(double t, const double *values);
+    double endTime(double t) const;
+    static bool needsState(const Serialiser *pSerialiser, double next_t);
+    void serialiseState(double t, double next_t, const state_vector &values);
+    double mStartTime = 0;
+    bool mFromCheckpoint = false;
+    bool mResumeGenerator = false;
+    double mEndTime = 0;
+    state_vector mEndStates;
+    void startRealisation(state_vector &current_states);
+    void recordEnd(const double *values);
 
 protected:
     state_values states;
@@ -77,13 +174,74 @@ protected:
 
 public:
     void setDebug();
+    void setVerbose(bool status);
+    //Diagnostics go to log, std::cout by default. A chain run off R's main thread needs a stream of its own.
+    void setLog(std::ostream *log);
     void setSerialiser(Serialiser *serialiser);
+    //Also logs the transition fired at every event, for solveGillespie and solveNextReaction.
+    void setEventLog(EventLogWriter *event_log);
     const static int SOLVER_TYPE_GILLESPIE = -1;
+    const static int SOLVER_TYPE_NEXT_REACTION = -2;
+    const static int SOLVER_TYPE_TAU_LEAP = -3;
+    const static int SOLVER_TYPE_HYBRID = -4;
+    const static int SOLVER_TYPE_RKD5 = 1;
+    const static int SOLVER_TYPE_RK4 = 2;
+    const static int SOLVER_TYPE_FORWARD_EULER = 3;
+    const static int SOLVER_TYPE_CASH_KARP = 4;
+    const static int SOLVER_TYPE_ROSENBROCK = 5;
+    static bool isStochastic(int solver_type);
     void addState(std::string state_name, double initial_value);
     void addTransition(Transition *transition);
     void setMaxTime(double newMaxTime);
+    void compile();
     void solve(int solver_type);
-    void setSeed(double seed);
+    void setSeed(uint64_t seed, uint64_t realisation = 0);
+    void setTauLeapEpsilon(double epsilon);
+    void setHybridStepSize(double step_size);
+    void setHybridThresholds(double rate_threshold, double population_threshold);
+    //Ends a run once the summed value of the given states falls to threshold or below or, with above
+    //set, reaches threshold or above. Checked after every event or accepted step, by every solver
+    //except solveBatch. The state at that point is held over the rest of the output grid.
+    void addStoppingCondition(std::vector<std::string> states, double threshold, bool above = false);
+    //The time at which a stopping condition ended the last run, or infinity if none did.
+    double getStoppingTime() const;
+    //Binary snapshot of the end of the last run: its time, the value of every state (counters included)
+    //and the random number generator. Empty if no run has finished since the chain was compiled.
+    std::string getCheckpoint() const;
+    //Later runs start from the checkpoint's time and states rather than from t = 0 and the initial
+    //values, and still end at the max time. Held states keep their initial values, so a run can, say,
+    //introduce infection into a population whose demography was simulated once. If the next run is
+    //stochastic, it continues the checkpoint's random number stream exactly. Returns false on a malformed checkpoint.
+    bool restoreCheckpoint(const std::string &checkpoint, std::vector<std::string> held_states = {});
+    //As restoreCheckpoint, but the next stochastic run draws from a stream of its own, derived from the
+    //checkpoint and branch, so branches forked from one checkpoint are independent continuations.
+    bool forkCheckpoint(const std::string &checkpoint, uint64_t branch, std::vector<std::string> held_states = {});
+    //The time a checkpoint was taken at, or NaN if it is malformed.
+    static double getCheckpointTime(const std::string &checkpoint);
+    //Replaces the initial values with a steady state of the deterministic system. Held states are
+    //treated as zero during the search and keep their initial values afterwards. Counters are always held.
+    bool findEquilibrium(std::vector<std::string> held_states = {}, int max_iterations = 1000, double tolerance = 1e-10);
+    //Stochastic solvers start each realisation from Poisson draws around the equilibrated values.
+    void setDrawInitialStates(bool status);
+    //Registers a parameter for forward sensitivity analysis: the transition's rate parameter changes by
+    //rate_derivative per unit change in it. A parameter may drive any number of transitions.
+    void addSensitivity(std::string parameter, Transition *transition, double rate_derivative);
+    std::vector<std::string> getSensitivityParameters() const;
+    //The largest difference, over every transition and every state its rate reads, between getRateGradient
+    //at the initial values and a central difference of getRate, relative to the larger of the two. The
+    //Rosenbrock solver and the equilibrium search build their Jacobian from these gradients.
+    double getRateGradientError();
+    //Dormand-Prince on the states together with their derivatives with respect to every registered
+    //parameter. States go to the chain's serialiser, and the sensitivities to one serialiser per
+    //parameter, in the order of getSensitivityParameters().
+    void solveSensitivities(std::vector<Serialiser *> serialisers);
+    //Dormand-Prince on chains that share one structure but not their parameters, integrated
+    //Transition::BATCH_LANES at a time. Each chain's states go to its own serialiser.
+    static void solveBatch(std::vector<MarkovChain *> chains);
+    //Passes the states of a logged run to serialiser as its solver did, from the last keyframe at or before
+    //from_time to the end of the run. The chain must have the states and transitions of the logged run,
+    //though not necessarily its parameters. Returns false if the log does not match the chain.
+    bool replayEventLog(const std::string &filename, Serialiser *serialiser, double from_time = -std::numeric_limits<double>::infinity());
     void cleanup();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+//Philox4x32-10 counter-based generator (Salmon et al., 2011).
+//Each output block is a keyed bijection of a 128-bit counter, so a stream is fully determined by its
+//key and the counter's upper words. The chain uses the seed as the key and the realisation number as
+//the stream, which makes every realisation independent of which thread runs it, or in what order.
+//Satisfies the uniform random bit generator requirements, so it can drive the boost distributions.
+class PhiloxEngine
+{
+public:
+    typedef uint32_t result_type;
+
+    //Everything needed to resume the stream exactly.
+    struct State
+    {
+        uint32_t key[2];
+        uint32_t counter[4];
+        uint32_t index;
+    };
+
+    PhiloxEngine(uint64_t seed = 0, uint64_t stream = 0)
+    {
+        this->seed(seed, stream);
+    }
+
+    void seed(uint64_t seed, uint64_t stream = 0)
+    {
+        mState.key[0] = (uint32_t)seed;
+        mState.key[1] = (uint32_t)(seed >> 32);
+        mState.counter[0] = 0;
+        mState.counter[1] = 0;
+        mState.counter[2] = (uint32_t)stream;
+        mState.counter[3] = (uint32_t)(stream >> 32);
+        mState.index = 4;
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT32_MAX; }
+
+    result_type operator()()
+    {
+        if (mState.index == 4)
+        {
+            generateBlock();
+            mState.index = 0;
+            if (++mState.counter[0] == 0)
+                ++mState.counter[1];
+        }
+        return (mBlock[mState.index++]);
+    }
+
+    //Uniform double on [0, 1) with 53 random bits.
+    double uniform()
+    {
+        uint64_t high = (*this)() >> 5;
+        uint64_t low = (*this)() >> 6;
+        return ((high * 67108864.0 + low) * (1.0 / 9007199254740992.0));
+    }
+
+    State getState() const
+    {
+        return (mState);
+    }
+
+    void setState(const State &state)
+    {
+        mState = state;
+        if (mState.index < 4)
+        {
+            //The block in use was generated from the previous counter value.
+            uint32_t counter_0 = mState.counter[0];
+            uint32_t counter_1 = mState.counter[1];
+            if (mState.counter[0]-- == 0)
+                mState.counter[1]--;
+            generateBlock();
+            mState.counter[0] = counter_0;
+            mState.counter[1] = counter_1;
+        }
+    }
+
+    //Moves to the start of a new stream derived from the current stream, its position and branch. Every
+    //branch forked from one point draws numbers independent of the other branches and of the stream
+    //it was forked from, and the same point and branch always give the same stream.
+    void fork(uint64_t branch)
+    {
+        uint64_t stream = ((uint64_t)mState.counter[3] << 32) | mState.counter[2];
+        uint64_t position = ((uint64_t)mState.counter[1] << 32) | mState.counter[0];
+        uint64_t derived = mix64(mix64(stream ^ mix64(position + mState.index)) + branch);
+        mState.counter[0] = 0;
+        mState.counter[1] = 0;
+        mState.counter[2] = (uint32_t)derived;
+        mState.counter[3] = (uint32_t)(derived >> 32);
+        mState.index = 4;
+    }
+
+private:
+    State mState;
+    uint32_t mBlock[4];
+
+    //SplitMix64 finaliser.
+    static uint64_t mix64(uint64_t z)
+    {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return (z ^ (z >> 31));
+    }
+
+    void generateBlock()
+    {
+        const uint32_t M0 = 0xD2511F53;
+        const uint32_t M1 = 0xCD9E8D57;
+        const uint32_t W0 = 0x9E3779B9;
+        const uint32_t W1 = 0xBB67AE85;
+
+        uint32_t c[4] = {mState.counter[0], mState.counter[1], mState.counter[2], mState.counter[3]};
+        uint32_t k[2] = {mState.key[0], mState.key[1]};
+        for (int round = 0; round < 10; round++)
+        {
+            if (round > 0)
+            {
+                k[0] += W0;
+                k[1] += W1;
+            }
+            uint64_t product_0 = (uint64_t)M0 * c[0];
+            uint64_t product_1 = (uint64_t)M1 * c[2];
+            uint32_t next[4] = {(uint32_t)(product_1 >> 32) ^ c[1] ^ k[0], (uint32_t)product_1,
+                                (uint32_t)(product_0 >> 32) ^ c[3] ^ k[1], (uint32_t)product_0};
+            c[0] = next[0];
+            c[1] = next[1];
+            c[2] = next[2];
+            c[3] = next[3];
+        }
+        mBlock[0] = c[0];
+        mBlock[1] = c[1];
+        mBlock[2] = c[2];
+        mBlock[3] = c[3];
+    }
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef PROPENSITYSUMTREE_H
+#define PROPENSITYSUMTREE_H
+
+#include <vector>
+
+//Complete binary tree whose leaves are the transition rates and whose internal nodes hold the sum
+//of their children. Updating a rate and sampling a transition proportional to its rate are both O(log n).
+//Internal nodes are recomputed from their children rather than adjusted by differences, so rounding
+//error cannot accumulate in the total over a long run.
+class PropensitySumTree
+{
+private:
+    int mCapacity = 1;
+    std::vector<double> mTree;
+
+public:
+    PropensitySumTree(int size)
+    {
+        while (mCapacity < size)
+            mCapacity *= 2;
+        mTree.assign(2 * mCapacity, 0);
+    }
+
+    //Sets a leaf without updating its ancestors. Call rebuild() once all leaves are set.
+    void setLeaf(int i, double rate)
+    {
+        mTree[mCapacity + i] = rate;
+    }
+
+    void rebuild()
+    {
+        for (int node = mCapacity - 1; node > 0; node--)
+        {
+            mTree[node] = mTree[2 * node] + mTree[2 * node + 1];
+        }
+    }
+
+    void update(int i, double rate)
+    {
+        int node = mCapacity + i;
+        mTree[node] = rate;
+        for (node /= 2; node > 0; node /= 2)
+        {
+            mTree[node] = mTree[2 * node] + mTree[2 * node + 1];
+        }
+    }
+
+    double getRate(int i) const
+    {
+        return (mTree[mCapacity + i]);
+    }
+
+    double total() const
+    {
+        return (mTree[1]);
+    }
+
+    //Returns the transition whose cumulative rate interval contains u * total(), for u in [0, 1).
+    int sample(double u) const
+    {
+        double target = u * mTree[1];
+        int node = 1;
+        while (node < mCapacity)
+        {
+            int left = 2 * node;
+            if (target < mTree[left] || mTree[left + 1] <= 0)
+            {
+                node = left;
+            }
+            else
+            {
+                target -= mTree[left];
+                node = left + 1;
+            }
+        }
+        return (node - mCapacity);
+    }
+};
+
+#endif
@@ -1,28 +1,118 @@
 #include "Serialiser.hpp"
 #include "StateValues.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <zlib.h>
 
-void Serialiser::serialise(double t, state_values states) 
+GridSampler::GridSampler(std::vector<double> times) : mTimes(times) {}
+
+
+size_t GridSampler::size() const
+{
+    return (mTimes.size());
+}
+
+
+double GridSampler::next() const
+{
+    if (mCursor < mTimes.size())
+        return (mTimes[mCursor]);
+    return (std::numeric_limits<double>::infinity());
+}
+
+
+void GridSampler::advance()
+{
+    if (mCursor < mTimes.size())
+        mCursor++;
+}
+
+
+double Serialiser::getNextTime() const
+{
+    return (-std::numeric_limits<double>::infinity());
+}
+
+
+Serialiser::~Serialiser() {}
+
+
+void Serialiser::setSchema(const state_index &schema)
+{
+    mNames.clear();
+    mSlots.clear();
+    for (auto &column : schema)
+    {
+        mNames.push_back(column.first);
+        mSlots.push_back(column.second);
+    }
+}
+
+
+const std::vector<std::string> &Serialiser::getNames() const
+{
+    return (mNames);
+}
+
+
+const std::vector<int> &Serialiser::getSlots() const
+{
+    return (mSlots);
+}
+
+
+void Serialiser::serialise(double t, const double *values) 
 {
     std::cout << t;
-    for (typename state_values::iterator it = states.begin(); it != states.end(); it++)
+    for (int slot : mSlots)
     {
-        std::cout << "," << it->second;
+        std::cout << "," << values[slot];
     }
     std::cout << "\n";
 }
 
 
-void Serialiser::serialiseHeader(state_values states) 
+void Serialiser::serialiseHeader(const state_index &schema) 
 {
+    setSchema(schema);
     std::cout << "t";
-    for (typename state_values::iterator it = states.begin(); it != states.end(); it++)
+    for (std::string &name : mNames)
     {
-        std::cout << "," << it->first;
+        std::cout << "," << name;
     }
     std::cout << "\n";
 }
 
-void Serialiser::serialiseFinally(double t, state_values states) {}
+void Serialiser::serialiseFinally(double t, const double *values) {}
+
+
+void Serialiser::serialiseHeader(const state_values &states)
+{
+    state_index schema;
+    int slot = 0;
+    for (auto &state : states)
+        schema.emplace_hint(schema.end(), state.first, slot++);
+    serialiseHeader(schema);
+}
+
+
+void Serialiser::serialise(double t, const state_values &states)
+{
+    mMapValues.clear();
+    for (auto &state : states)
+        mMapValues.push_back(state.second);
+    serialise(t, mMapValues.data());
+}
+
+
+void Serialiser::serialiseFinally(double t, const state_values &states)
+{
+    mMapValues.clear();
+    for (auto &state : states)
+        mMapValues.push_back(state.second);
+    serialiseFinally(t, mMapValues.data());
+}
 
 SerialiserFile::SerialiserFile(std::string filename) 
 {
@@ -30,87 +120,407 @@ SerialiserFile::SerialiserFile(std::string filename)
 }
 
 
-void SerialiserFile::serialise(double t, state_values states) 
+void SerialiserFile::serialise(double t, const double *values) 
 {   
     mOutputfile << t;
 
-    typename std::map<std::string, double>::iterator it;
-
-    for(it=states.begin(); it != states.end(); it++) {
-        mOutputfile << "," << it->second;
+    for (int slot : getSlots()) {
+        mOutputfile << "," << values[slot];
     }
     mOutputfile << "\n";
     mOutputfile.flush();
 }
 
 
-void SerialiserFile::serialiseHeader(state_values states) 
+void SerialiserFile::serialiseHeader(const state_index &schema) 
 {
+    setSchema(schema);
     mOutputfile << "t";
-    for (typename state_values::iterator it = states.begin(); it != states.end(); it++)
+    for (const std::string &name : getNames())
     {
-        mOutputfile << "," << it->first;
+        mOutputfile << "," << name;
     }
     mOutputfile << "\n";
     mOutputfile.flush();
 }
 
 
-void SerialiserFile::serialiseFinally(double t, state_values states) {}
+void SerialiserFile::serialiseFinally(double t, const double *values) {}
 
 
 
 SerialiserFileFinalState::SerialiserFileFinalState(std::string filename) : SerialiserFile(filename) {}
 
+
+//Only the state passed to serialiseFinally is written.
+double SerialiserFileFinalState::getNextTime() const
+{
+    return (std::numeric_limits<double>::infinity());
+}
+
     
-void SerialiserFileFinalState::serialise(double t, state_values states) {}
+void SerialiserFileFinalState::serialise(double t, const double *values) {}
+
+void SerialiserFileFinalState::serialiseFinally(double t, const double *values) 
+{
+    SerialiserFile::serialise(t, values);
+}
+
+
+SerialiserBinary::SerialiserBinary(std::string filename, bool single_precision, int block_rows) : mSinglePrecision(single_precision), mBlockRows(std::max(block_rows, 1))
+{
+    mOutputfile.open(filename, std::ios::binary);
+}
+
+
+SerialiserBinary::~SerialiserBinary()
+{
+    serialiseFinally(0, NULL);
+}
+
+
+void SerialiserBinary::serialiseHeader(const state_index &schema)
+{
+    setSchema(schema);
+    const uint32_t version = 1;
+    const uint32_t value_size = mSinglePrecision ? sizeof(float) : sizeof(double);
+    const uint64_t rows = 0;
+    const uint32_t columns = schema.size() + 1;
+    mOutputfile.write("MCTB", 4);
+    mOutputfile.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    mOutputfile.write(reinterpret_cast<const char *>(&value_size), sizeof(value_size));
+    mRowCountPosition = mOutputfile.tellp();
+    mOutputfile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+    mOutputfile.write(reinterpret_cast<const char *>(&columns), sizeof(columns));
+
+    std::vector<std::string> names = {"t"};
+    names.insert(names.end(), getNames().begin(), getNames().end());
+    for (std::string &name : names)
+    {
+        const uint32_t length = name.size();
+        mOutputfile.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        mOutputfile.write(name.data(), length);
+    }
+
+    mColumns = columns;
+    mBlock.assign(mColumns * mBlockRows, 0);
+    if (mSinglePrecision)
+        mSingleColumn.assign(mBlockRows, 0);
+}
+
+
+//Row r of column c is buffered at c * mBlockRows + r, so each column of a full block is contiguous.
+void SerialiserBinary::serialise(double t, const double *values)
+{
+    if (mColumns == 0 || mFinished)
+        return;
+    mBlock[mRows] = t;
+    const std::vector<int> &slots = getSlots();
+    for (size_t c = 1; c < mColumns; c++)
+        mBlock[c * mBlockRows + mRows] = values[slots[c - 1]];
+    if (++mRows == mBlockRows)
+        writeBlock();
+}
+
+
+void SerialiserBinary::writeBlock()
+{
+    if (mRows == 0)
+        return;
+    const uint32_t rows = mRows;
+    mOutputfile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+    for (size_t c = 0; c < mColumns; c++)
+    {
+        const double *column = &mBlock[c * mBlockRows];
+        if (mSinglePrecision)
+        {
+            for (int r = 0; r < mRows; r++)
+                mSingleColumn[r] = column[r];
+            mOutputfile.write(reinterpret_cast<const char *>(mSingleColumn.data()), mRows * sizeof(float));
+        }
+        else
+            mOutputfile.write(reinterpret_cast<const char *>(column), mRows * sizeof(double));
+    }
+    mTotalRows += mRows;
+    mRows = 0;
+}
+
 
-void SerialiserFileFinalState::serialiseFinally(double t, state_values states) 
+//Like SerialiserFile, records nothing at the final time: every event has already been written.
+void SerialiserBinary::serialiseFinally(double t, const double *values)
 {
-    SerialiserFile::serialise(t, states);
+    if (mColumns == 0 || mFinished)
+        return;
+    writeBlock();
+    mOutputfile.seekp(mRowCountPosition);
+    mOutputfile.write(reinterpret_cast<const char *>(&mTotalRows), sizeof(mTotalRows));
+    mOutputfile.close();
+    mFinished = true;
 }
 
 
-SerialiserPredefinedTimes::SerialiserPredefinedTimes(std::vector<double> serialiseTimes) : mSerialiseTimes(serialiseTimes) {}
+namespace
+{
+//Zigzag maps small changes of either sign to small unsigned numbers, which take few varint bytes.
+void appendVarint(std::string &buffer, int64_t value)
+{
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (zigzag >= 0x80)
+    {
+        buffer.push_back(static_cast<char>((zigzag & 0x7f) | 0x80));
+        zigzag >>= 7;
+    }
+    buffer.push_back(static_cast<char>(zigzag));
+}
+}
+
+
+SerialiserDelta::SerialiserDelta(std::string filename, bool compress, int block_rows) : mCompress(compress), mBlockRows(std::max(block_rows, 1))
+{
+    mOutputfile.open(filename, std::ios::binary);
+}
+
+
+SerialiserDelta::~SerialiserDelta()
+{
+    serialiseFinally(0, NULL);
+}
+
+
+void SerialiserDelta::serialiseHeader(const state_index &schema)
+{
+    setSchema(schema);
+    const uint32_t version = 1;
+    const uint32_t flags = mCompress ? 1 : 0;
+    const uint64_t rows = 0;
+    const uint32_t columns = schema.size() + 1;
+    mOutputfile.write("MCTD", 4);
+    mOutputfile.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    mOutputfile.write(reinterpret_cast<const char *>(&flags), sizeof(flags));
+    mRowCountPosition = mOutputfile.tellp();
+    mOutputfile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+    mOutputfile.write(reinterpret_cast<const char *>(&columns), sizeof(columns));
+
+    std::vector<std::string> names = {"t"};
+    names.insert(names.end(), getNames().begin(), getNames().end());
+    for (std::string &name : names)
+    {
+        const uint32_t length = name.size();
+        mOutputfile.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        mOutputfile.write(name.data(), length);
+    }
+
+    mStates = schema.size();
+    mTimes.assign(mBlockRows, 0);
+    mBlock.assign(mStates * mBlockRows, 0);
+    mStarted = true;
+}
+
+
+//Row r of state column c is buffered at c * mBlockRows + r, as in SerialiserBinary.
+void SerialiserDelta::serialise(double t, const double *values)
+{
+    if (!mStarted || mFinished)
+        return;
+    mTimes[mRows] = t;
+    const std::vector<int> &slots = getSlots();
+    for (size_t c = 0; c < mStates; c++)
+        mBlock[c * mBlockRows + mRows] = std::llround(values[slots[c]]);
+    if (++mRows == mBlockRows)
+        writeBlock();
+}
+
+
+//Each block starts its changes from zero, so blocks can be decoded on their own.
+void SerialiserDelta::writeBlock()
+{
+    if (mRows == 0)
+        return;
+    mEncoded.assign(reinterpret_cast<const char *>(mTimes.data()), mRows * sizeof(double));
+    for (size_t c = 0; c < mStates; c++)
+    {
+        const int64_t *column = &mBlock[c * mBlockRows];
+        int64_t previous = 0;
+        for (int r = 0; r < mRows; r++)
+        {
+            appendVarint(mEncoded, column[r] - previous);
+            previous = column[r];
+        }
+    }
+
+    const uint32_t rows = mRows;
+    const uint32_t encoded_size = mEncoded.size();
+    mOutputfile.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+    if (mCompress)
+    {
+        uLongf compressed_size = compressBound(encoded_size);
+        mCompressed.resize(compressed_size);
+        //A failed block would leave the file undecodable, so it is closed unfinished rather than written.
+        if (compress2(mCompressed.data(), &compressed_size, reinterpret_cast<const Bytef *>(mEncoded.data()), encoded_size, Z_DEFAULT_COMPRESSION) != Z_OK)
+        {
+            mOutputfile.close();
+            mFinished = true;
+            throw std::runtime_error("Could not compress a block of the delta-encoded trajectory");
+        }
+        const uint32_t stored_size = compressed_size;
+        mOutputfile.write(reinterpret_cast<const char *>(&stored_size), sizeof(stored_size));
+        mOutputfile.write(reinterpret_cast<const char *>(&encoded_size), sizeof(encoded_size));
+        mOutputfile.write(reinterpret_cast<const char *>(mCompressed.data()), stored_size);
+    }
+    else
+    {
+        mOutputfile.write(reinterpret_cast<const char *>(&encoded_size), sizeof(encoded_size));
+        mOutputfile.write(mEncoded.data(), encoded_size);
+    }
+    mTotalRows += mRows;
+    mRows = 0;
+}
+
+
+//Records nothing at the final time, as SerialiserBinary.
+void SerialiserDelta::serialiseFinally(double t, const double *values)
+{
+    if (!mStarted || mFinished)
+        return;
+    writeBlock();
+    mOutputfile.seekp(mRowCountPosition);
+    mOutputfile.write(reinterpret_cast<const char *>(&mTotalRows), sizeof(mTotalRows));
+    mOutputfile.close();
+    mFinished = true;
+}
+
+
+SerialiserPredefinedTimes::SerialiserPredefinedTimes(std::vector<double> serialiseTimes) : mGrid(serialiseTimes) {}
     
 
-void SerialiserPredefinedTimes::serialise(double t, state_values states) 
+double SerialiserPredefinedTimes::getNextTime() const
 {
-    double next_time = *mSerialiseTimes.begin();
+    return (mGrid.next());
+}
+
 
-    while (t > next_time) 
+//The state last passed in is held until the next, so it is written at every output time in between.
+void SerialiserPredefinedTimes::serialise(double t, const double *values) 
+{
+    //Output times before the first state get that state.
+    if (mLastState.empty())
+        mLastState.assign(values, values + getSlots().size());
+    while (t > mGrid.next()) 
     {
-        Serialiser::serialise(next_time, mLastState);
-        mSerialiseTimes.erase(mSerialiseTimes.begin());
-        next_time = *mSerialiseTimes.begin();
+        Serialiser::serialise(mGrid.next(), mLastState.data());
+        mGrid.advance();
     }
-    mLastState = states;
+    mLastState.assign(values, values + getSlots().size());
+}
+
+
+SerialiserPredefinedTimesMemory::SerialiserPredefinedTimesMemory(std::vector<double> serialiseTimes) : mGrid(serialiseTimes) {}
+
+
+void SerialiserPredefinedTimesMemory::setShouldInterpolate(bool status)
+{
+    mShouldInterpolate = status;
+}
+
+
+double SerialiserPredefinedTimesMemory::getNextTime() const
+{
+    return (mGrid.next());
 }
 
 
-SerialiserPredefinedTimesFile::SerialiserPredefinedTimesFile(std::vector<double> serialiseTimes, std::string filename) : SerialiserFile(filename), mSerialiseTimes(serialiseTimes) {}
+void SerialiserPredefinedTimesMemory::serialise(double t, const double *values)
+{
+    const std::vector<int> &slots = getSlots();
+    //Output times before the first state get that state.
+    if (mLastState.empty())
+    {
+        mLastState.assign(values, values + slots.size());
+        mLastT = t;
+    }
+    while (t > mGrid.next())
+    {
+        double next_time = mGrid.next();
+        mpTimes->push_back(next_time);
+        for (size_t c = 0; c < slots.size(); c++)
+        {
+            double value = mLastState[slots[c]];
+            if (mShouldInterpolate && t > mLastT)
+            {
+                double slope = (values[slots[c]] - mLastState[slots[c]]) / (t - mLastT);
+                value = slope * (next_time - mLastT) + mLastState[slots[c]];
+            }
+            mColumns[c]->push_back(value);
+        }
+        mGrid.advance();
+    }
+    mLastState.assign(values, values + slots.size());
+    mLastT = t;
+}
+
+
+//Every column is looked up once, and sized for the whole grid.
+void SerialiserPredefinedTimesMemory::serialiseHeader(const state_index &schema)
+{
+    setSchema(schema);
+    mpTimes = &mResults["t"];
+    mpTimes->reserve(mGrid.size());
+    mColumns.clear();
+    for (const std::string &name : getNames())
+    {
+        mColumns.push_back(&mResults[name]);
+        mColumns.back()->reserve(mGrid.size());
+    }
+}
+
+
+void SerialiserPredefinedTimesMemory::serialiseFinally(double t, const double *values)
+{
+    serialise(t, values);
+}
+
+
+const std::map<std::string, std::vector<double>> &SerialiserPredefinedTimesMemory::getColumns() const
+{
+    return (mResults);
+}
+
+
+SerialiserPredefinedTimesFile::SerialiserPredefinedTimesFile(std::vector<double> serialiseTimes, std::string filename) : SerialiserFile(filename), mGrid(serialiseTimes) {}
+
+
+double SerialiserPredefinedTimesFile::getNextTime() const
+{
+    return (mGrid.next());
+}
 
  
-void SerialiserPredefinedTimesFile::serialise(double t, state_values states) {
-    double next_time = *mSerialiseTimes.begin();
-    while (t > next_time && !mSerialiseTimes.empty()) {
+void SerialiserPredefinedTimesFile::serialise(double t, const double *values) {
+    const std::vector<int> &slots = getSlots();
+    //Output times before the first state get that state.
+    if (mLastState.empty())
+    {
+        mLastState.assign(values, values + slots.size());
+        mLastT = t;
+    }
+    mInterpolated.resize(slots.size());
+    while (t > mGrid.next()) {
+        double next_time = mGrid.next();
         //Interpolate between the points.
-        state_values interpolated_states;
-        for (auto &p : states)
+        for (int slot : slots)
         {
-            double slope = ( (double) p.second - mLastState[p.first]) / (t - mLastT);
-            interpolated_states[p.first] = slope * (next_time - mLastT) + mLastState[p.first];
+            double slope = t > mLastT ? (values[slot] - mLastState[slot]) / (t - mLastT) : 0;
+            mInterpolated[slot] = slope * (next_time - mLastT) + mLastState[slot];
         }
-        SerialiserFile::serialise(next_time, interpolated_states);
-        mSerialiseTimes.erase(mSerialiseTimes.begin());
-        next_time = *mSerialiseTimes.begin();
+        SerialiserFile::serialise(next_time, mInterpolated.data());
+        mGrid.advance();
     }
-    mLastState = states;
+    mLastState.assign(values, values + slots.size());
     mLastT = t;
 }
 
 
-void SerialiserPredefinedTimesFile::serialiseFinally(double t, state_values states)
+void SerialiserPredefinedTimesFile::serialiseFinally(double t, const double *values)
 {
-    serialise(t, states);
-}
\ No newline at end of file
+    serialise(t, values);
+}
@@ -5,13 +5,57 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <limits>
+
+//Cursor over the increasing output times of a grid, shared by the serialisers that sample a run on
+//one. Moving on to the next time is O(1), and once the grid is used up next() is infinity.
+class GridSampler
+{
+private:
+    std::vector<double> mTimes;
+    size_t mCursor = 0;
+
+public:
+    GridSampler(std::vector<double> times);
+    size_t size() const;
+    double next() const;
+    void advance();
+};
 
 class Serialiser
 {
+private:
+    std::vector<std::string> mNames;
+    std::vector<int> mSlots;
+    state_vector mMapValues;
+
+protected:
+    //Takes in the schema: serialisers that override serialiseHeader call this first.
+    void setSchema(const state_index &schema);
+    //The states in column (name) order, and the position of each one's value.
+    const std::vector<std::string> &getNames() const;
+    const std::vector<int> &getSlots() const;
+
 public:
-    virtual void serialise(double t, state_values states);
-    virtual void serialiseHeader(state_values states);
-    virtual void serialiseFinally(double t, state_values states);
+    virtual ~Serialiser();
+    //The earliest output time still to come. Solvers may leave out states that are held only up to
+    //it, as long as they pass the last state before each output time is crossed and the first one
+    //after it. The default, -infinity, asks for every state.
+    virtual double getNextTime() const;
+    //States are passed as spans. The schema comes once, before any values, and maps every state's
+    //name to its position in the value arrays of the later calls, positions 0 to schema.size() - 1.
+    //The arrays belong to the caller and are only read during the call, so nothing is copied to
+    //serialise a state that is not kept.
+    virtual void serialiseHeader(const state_index &schema);
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseFinally(double t, const double *values);
+    //For callers holding named states: the keys make the schema, and values are taken in key order.
+    void serialiseHeader(const state_values &states);
+    void serialise(double t, const state_values &states);
+    void serialiseFinally(double t, const state_values &states);
 };
 
 class SerialiserFile : public Serialiser
@@ -21,9 +65,9 @@ private:
 
 public:
     SerialiserFile(std::string filename);
-    virtual void serialise(double t, state_values states);
-    virtual void serialiseHeader(state_values states);
-    virtual void serialiseFinally(double t, state_values states);
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseHeader(const state_index &schema);
+    virtual void serialiseFinally(double t, const double *values);
 };
 
 
@@ -31,33 +75,124 @@ class SerialiserFileFinalState : public SerialiserFile
 {
 public:
     SerialiserFileFinalState(std::string filename);
-    virtual void serialise(double t, state_values states);
-    virtual void serialiseFinally(double t, state_values states);
+    virtual double getNextTime() const;
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseFinally(double t, const double *values);
 };
 
 
 class SerialiserPredefinedTimes : public Serialiser
 {
 private:
-    std::vector<double> mSerialiseTimes;
-    state_values mLastState;
+    GridSampler mGrid;
+    state_vector mLastState;
 
 public:
     SerialiserPredefinedTimes(std::vector<double> serialiseTimes);
-    virtual void serialise(double t, state_values states);
+    virtual double getNextTime() const;
+    virtual void serialise(double t, const double *values);
+};
+
+
+//Keeps the states at the predefined times in memory, one column per state plus "t".
+//Holds no global state, so one instance per realisation can be filled from its own thread.
+class SerialiserPredefinedTimesMemory : public Serialiser
+{
+private:
+    std::map<std::string, std::vector<double>> mResults;
+    std::vector<double> *mpTimes = NULL;
+    std::vector<std::vector<double> *> mColumns;
+    GridSampler mGrid;
+    state_vector mLastState;
+    double mLastT = 0;
+    bool mShouldInterpolate = true;
+
+public:
+    SerialiserPredefinedTimesMemory(std::vector<double> serialiseTimes);
+    void setShouldInterpolate(bool status);
+    virtual double getNextTime() const;
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseHeader(const state_index &schema);
+    virtual void serialiseFinally(double t, const double *values);
+    const std::map<std::string, std::vector<double>> &getColumns() const;
+};
+
+
+//Writes every serialised state to a columnar binary file (see BinaryTrajectoryReader.hpp for the
+//layout), one column per state plus "t". Rows are buffered and written out in blocks, each holding its
+//columns one after another, so a block costs one write per column and nothing is formatted as text.
+//With single_precision, values are stored as floats: half the size, and exact for counts up to 2^24.
+//The format saves time, not space: files are usually larger than SerialiserFile's text output.
+//SerialiserDelta is the compact one.
+//The row count in the header is filled in by serialiseFinally, or on destruction.
+class SerialiserBinary : public Serialiser
+{
+private:
+    std::ofstream mOutputfile;
+    bool mSinglePrecision;
+    int mBlockRows;
+    int mRows = 0;
+    uint64_t mTotalRows = 0;
+    size_t mColumns = 0;
+    std::vector<double> mBlock;
+    std::vector<float> mSingleColumn;
+    std::streampos mRowCountPosition;
+    bool mFinished = false;
+    void writeBlock();
+
+public:
+    SerialiserBinary(std::string filename, bool single_precision = false, int block_rows = 4096);
+    ~SerialiserBinary();
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseHeader(const state_index &schema);
+    virtual void serialiseFinally(double t, const double *values);
+};
+
+
+//Writes every serialised state as whole counts, for the stochastic solvers, to a compact file (see
+//DeltaTrajectoryReader.hpp for the layout). Consecutive states differ in a column or two, so within a
+//block each state's column is stored as the changes from the row before, zigzag and varint encoded: an
+//unchanged count takes one byte. Values are rounded to the nearest integer. With compress, each block is
+//also deflated with zlib. The row count in the header is filled in by serialiseFinally, or on destruction.
+class SerialiserDelta : public Serialiser
+{
+private:
+    std::ofstream mOutputfile;
+    bool mCompress;
+    int mBlockRows;
+    int mRows = 0;
+    uint64_t mTotalRows = 0;
+    size_t mStates = 0;
+    bool mStarted = false;
+    std::vector<double> mTimes;
+    std::vector<int64_t> mBlock;
+    std::string mEncoded;
+    std::vector<unsigned char> mCompressed;
+    std::streampos mRowCountPosition;
+    bool mFinished = false;
+    void writeBlock();
+
+public:
+    SerialiserDelta(std::string filename, bool compress = false, int block_rows = 4096);
+    ~SerialiserDelta();
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseHeader(const state_index &schema);
+    virtual void serialiseFinally(double t, const double *values);
 };
 
 
 class SerialiserPredefinedTimesFile : public SerialiserFile {
 private:
-    std::vector<double> mSerialiseTimes;
-    state_values mLastState;
-    double mLastT;
+    GridSampler mGrid;
+    state_vector mLastState;
+    state_vector mInterpolated;
+    double mLastT = 0;
 
 public:
     SerialiserPredefinedTimesFile(std::vector<double> serialiseTimes, std::string filename);
-    virtual void serialise(double t, state_values states);
-    virtual void serialiseFinally(double t, state_values states);
+    virtual double getNextTime() const;
+    virtual void serialise(double t, const double *values);
+    virtual void serialiseFinally(double t, const double *values);
 };
 
 #endif
\ No newline at end of file
@@ -3,9 +3,14 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 using state_values = std::map<std::string, double>;
 
+//Compiled states: each state name is resolved to a slot in a flat vector.
+using state_index = std::map<std::string, int>;
+using state_vector = std::vector<double>;
+
 #endif
 
 #ifndef PARAMETER_MAP_H_
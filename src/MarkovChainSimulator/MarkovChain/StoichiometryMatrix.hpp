@@ -0,0 +1,92 @@
+#ifndef STOICHIOMETRYMATRIX_H
+#define STOICHIOMETRYMATRIX_H
+
+#include <utility>
+#include <vector>
+
+//Sparse transitions x states matrix in compressed row form. Row j holds the change in each state,
+//counters included, when transition j fires once. The deterministic right hand side is then the
+//product of the transposed matrix with the vector of rates.
+class StoichiometryMatrix
+{
+private:
+    int mColumns = 0;
+    std::vector<int> mRowStart = std::vector<int>(1, 0);
+    std::vector<int> mColumnIndices;
+    std::vector<double> mValues;
+
+public:
+    void clear(int columns)
+    {
+        mColumns = columns;
+        mRowStart.assign(1, 0);
+        mColumnIndices.clear();
+        mValues.clear();
+    }
+
+    //Appends the next row from (state, change) pairs. Repeated states are merged.
+    void addRow(const std::vector<std::pair<int, double>> &changes)
+    {
+        size_t start = mRowStart.back();
+        for (auto &change : changes)
+        {
+            size_t k = start;
+            while (k < mColumnIndices.size() && mColumnIndices[k] != change.first)
+                k++;
+            if (k < mColumnIndices.size())
+            {
+                mValues[k] += change.second;
+                continue;
+            }
+            mColumnIndices.push_back(change.first);
+            mValues.push_back(change.second);
+        }
+        mRowStart.push_back(mColumnIndices.size());
+    }
+
+    int rows() const
+    {
+        return (mRowStart.size() - 1);
+    }
+
+    int columns() const
+    {
+        return (mColumns);
+    }
+
+    int rowBegin(int row) const
+    {
+        return (mRowStart[row]);
+    }
+
+    int rowEnd(int row) const
+    {
+        return (mRowStart[row + 1]);
+    }
+
+    int getColumn(int k) const
+    {
+        return (mColumnIndices[k]);
+    }
+
+    double getValue(int k) const
+    {
+        return (mValues[k]);
+    }
+
+    //result = S^T * rates, i.e. the rate of change of every state.
+    void multiplyTransposed(const double *rates, double *result) const
+    {
+        for (int i = 0; i < mColumns; i++)
+            result[i] = 0;
+        const int rows = mRowStart.size() - 1;
+        for (int row = 0; row < rows; row++)
+        {
+            const double rate = rates[row];
+            for (int k = mRowStart[row]; k < mRowStart[row + 1]; k++)
+                result[mColumnIndices[k]] += mValues[k] * rate;
+        }
+    }
+};
+
+#endif
@@ -1,9 +1,21 @@
 #include <iostream>
 #include <utility>
+#include <numeric>
+#include <functional>
+#include <algorithm>
+#include <cmath>
 #include "StateValues.h"
 
 class Transition {
 
+public:
+  //How the hybrid solver treats this transition. Automatic transitions are classed as fast
+  //(continuous) while both their rate and their source population are large.
+  enum Partition { PARTITION_AUTOMATIC, PARTITION_FAST, PARTITION_SLOW };
+
+  //Parameter sets evaluated together by getUnitRates: four doubles fill an AVX register.
+  const static int BATCH_LANES = 4;
+
 protected:
   std::string mSource_state;
   std::string mDestination_state;
@@ -11,27 +23,76 @@ protected:
   parameter_map mParameters;
   std::vector<std::string> mCounters;
 
-  double (*mpGetActualRate)(state_values pStates, parameter_map parameters);
+  //Resolved by compile(). "Void" (or any state not in the chain) resolves to -1.
+  int mSource_index = -1;
+  int mDestination_index = -1;
+  std::vector<int> mGoverning_indices;
+  std::vector<int> mCounter_indices;
+  double mRate = 0;
+
+  double (*mpGetActualRate)(const state_values &states, const parameter_map &parameters);
 
   int mTransition_type = 0;
+  Partition mPartition = PARTITION_AUTOMATIC;
+
+  static int resolveState(const state_index &index, const std::string &state)
+  {
+    state_index::const_iterator it = index.find(state);
+    if (it == index.end())
+      return (-1);
+    return (it->second);
+  }
 
-  virtual void incrementCounters(state_values &rStates)
+  static std::vector<int> resolveStates(const state_index &index, const std::vector<std::string> &states)
   {
-    if (mCounters.size() > 0)
+    std::vector<int> indices;
+    for (const std::string &state : states)
     {
-      for (std::string counter : this->mCounters)
-      {
-        rStates[counter] += 1;
-      }
+      int i = resolveState(index, state);
+      if (i >= 0)
+        indices.push_back(i);
+    }
+    return (indices);
+  }
+
+  double sumStates(const std::vector<int> &indices, const state_vector &states) const
+  {
+    double mass = 0;
+    for (int i : indices)
+    {
+      mass += states[i];
+    }
+    return (mass);
+  }
+
+  //sumStates in every lane of a batch. The lane count is fixed so that the inner loops vectorise.
+  static void sumLanes(const std::vector<int> &indices, const double *states, double *sums)
+  {
+    double mass[BATCH_LANES] = {0};
+    for (int i : indices)
+    {
+      const double *values = states + i * BATCH_LANES;
+      for (int b = 0; b < BATCH_LANES; b++)
+        mass[b] += values[b];
+    }
+    for (int b = 0; b < BATCH_LANES; b++)
+      sums[b] = mass[b];
+  }
+
+  virtual void incrementCounters(state_vector &rStates)
+  {
+    for (int counter : mCounter_indices)
+    {
+      rStates[counter] += 1;
     }
   }
 
 public:
-  
+
   Transition() {};
-  
-  Transition(std::string source_state, std::string destination_state, parameter_map parameters, double (*getActualRate)(state_values pStates, parameter_map parameters), std::vector<std::string> governing_states = {}) :
-    mSource_state(source_state), mDestination_state(destination_state), mParameters(parameters), mpGetActualRate(getActualRate), mGoverning_states(governing_states) 
+
+  Transition(std::string source_state, std::string destination_state, parameter_map parameters, double (*getActualRate)(const state_values &states, const parameter_map &parameters), std::vector<std::string> governing_states = {}) :
+    mSource_state(source_state), mDestination_state(destination_state), mParameters(parameters), mpGetActualRate(getActualRate), mGoverning_states(governing_states)
     {
       if (mGoverning_states.size() == 0) {
         mGoverning_states = {mDestination_state};
@@ -48,52 +109,175 @@ public:
       mParameters["parameter"] = parameter;
     }
 
-    
+  virtual ~Transition() {}
+
+  //Resolves every state name used by this transition to its slot in the chain's state vector.
+  virtual void compile(const state_index &index)
+  {
+    mSource_index = resolveState(index, mSource_state);
+    mDestination_index = resolveState(index, mDestination_state);
+    mGoverning_indices = resolveStates(index, mGoverning_states);
+    mCounter_indices = resolveStates(index, mCounters);
+    if (mParameters.count("parameter") > 0)
+      mRate = mParameters["parameter"];
+  }
+
   virtual void setStates(std::string source_state, std::string destination_state) {
     mSource_state = source_state;
     mDestination_state = destination_state;
   }
 
-  virtual void do_transition (double t, state_values &rStates) = 0;
+  virtual void do_transition(double t, state_vector &rStates)
+  {
+    if (mSource_index >= 0)
+      rStates[mSource_index] -= 1;
+    if (mDestination_index >= 0)
+      rStates[mDestination_index] += 1;
+
+    incrementCounters(rStates);
+  }
+
+  virtual double getRate(const state_vector &states) = 0;
 
-  virtual double getRate(state_values states) = 0;
+  //States read by getRate. Used to work out which rates change after a transition fires.
+  virtual std::vector<int> getRateDependencies() const
+  {
+    std::vector<int> dependencies = mGoverning_indices;
+    if (mSource_index >= 0)
+      dependencies.push_back(mSource_index);
+    return (dependencies);
+  }
+
+  //States changed by do_transition.
+  virtual std::vector<int> getAffectedStates() const
+  {
+    std::vector<int> affected = mCounter_indices;
+    if (mSource_index >= 0)
+      affected.push_back(mSource_index);
+    if (mDestination_index >= 0)
+      affected.push_back(mDestination_index);
+    return (affected);
+  }
+
+  //Partial derivatives of getRate with respect to the states it reads, as (state, derivative) pairs.
+  //A state may appear more than once, in which case its entries add up. Estimated by forward
+  //differences unless a transition knows its rate in closed form.
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
+  {
+    gradient.clear();
+    std::vector<int> dependencies = getRateDependencies();
+    std::sort(dependencies.begin(), dependencies.end());
+    dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+    if (dependencies.empty())
+      return;
+
+    state_vector perturbed = states;
+    double rate = getRate(states);
+    for (int i : dependencies)
+    {
+      double step = 1.49e-8 * std::max(std::fabs(states[i]), 1.0);
+      perturbed[i] = states[i] + step;
+      gradient.push_back(std::make_pair(i, (getRate(perturbed) - rate) / step));
+      perturbed[i] = states[i];
+    }
+  }
+
+  //Rate per unit of the transition's parameter, i.e. d(getRate)/d(parameter). The built-in rates
+  //are all proportional to their parameter, so this is getRate without mRate.
+  virtual double getUnitRate(const state_vector &states) const = 0;
 
-  virtual std::string getSourceState() const 
+  //getUnitRate for a batch of BATCH_LANES parameter sets that share this transition's structure,
+  //with state i of lane b at states[i * BATCH_LANES + b]. Returns false if the rate has no such form,
+  //in which case each lane's own getRate has to be used.
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    return (false);
+  }
+
+  //Change in each state when do_transition fires once, as (state, change) pairs.
+  virtual std::vector<std::pair<int, double>> getStoichiometry() const
+  {
+    std::vector<std::pair<int, double>> stoichiometry;
+    if (mSource_index >= 0)
+      stoichiometry.push_back(std::make_pair(mSource_index, -1.0));
+    if (mDestination_index >= 0)
+      stoichiometry.push_back(std::make_pair(mDestination_index, 1.0));
+    for (int counter : mCounter_indices)
+      stoichiometry.push_back(std::make_pair(counter, 1.0));
+    return (stoichiometry);
+  }
+
+  //Highest polynomial order of getRate in any single state. Used to bound the relative change
+  //in a rate during a tau-leap.
+  virtual int getOrder() const
+  {
+    return (1);
+  }
+
+  virtual std::string getSourceState() const
   {
     return (mSource_state);
   }
 
-  virtual void setSourceState(std::string source_state) 
+  virtual void setSourceState(std::string source_state)
   {
     mSource_state = source_state;
   }
 
-  virtual std::string getDestinationState() const 
+  virtual std::string getDestinationState() const
   {
     return (mDestination_state);
   }
 
-  virtual void setDestinationState(std::string destination_state) 
+  virtual void setDestinationState(std::string destination_state)
   {
     mDestination_state = destination_state;
   }
 
+  int getSourceIndex() const
+  {
+    return (mSource_index);
+  }
+
+  int getDestinationIndex() const
+  {
+    return (mDestination_index);
+  }
+
+  double getRateParameter() const
+  {
+    return (mRate);
+  }
+
   double getSingleParameter() const {
+    if (mParameters.empty())
+      return (0);
     return (mParameters.begin()->second);
   }
 
   void setSingleParameter(double parameter) {
     mParameters["parameter"] = parameter;
+    mRate = parameter;
   }
 
   std::vector<std::string> getGoverningStates() const {
-    return (mGoverning_states); 
+    return (mGoverning_states);
   }
 
   void setGoverningStates(std::vector<std::string> governing_states) {
     mGoverning_states = governing_states;
   }
 
+  void setPartition(Partition partition)
+  {
+    mPartition = partition;
+  }
+
+  Partition getPartition() const
+  {
+    return (mPartition);
+  }
+
   virtual void addCounter(std::string counter)
   {
     mCounters.push_back(counter);
@@ -108,29 +292,49 @@ public:
   {
     return (mCounters.size());
   }
-  
+
 
 };
 
 
-class TransitionIndividual : public Transition 
+class TransitionIndividual : public Transition
 {
 public:
   TransitionIndividual(std::string source_state, std::string destination_state, double parameter)
     : Transition(source_state, destination_state, parameter, {})
     {}
 
-  virtual double getRate(state_values states)
+  virtual double getRate(const state_vector &states)
   {
-    //std::cout << this->mSource_state << std::endl;
-    return (this->mParameters["parameter"] * states[this->mSource_state]);
+    if (this->mSource_index < 0)
+      return (0);
+    return (this->mRate * states[this->mSource_index]);
   }
 
-  virtual void do_transition(double t, state_values &rStates) {
-    rStates[this->mSource_state] -= 1;
-    rStates[this->mDestination_state] += 1;
+  virtual double getUnitRate(const state_vector &states) const
+  {
+    return (this->mSource_index >= 0 ? states[this->mSource_index] : 0);
+  }
 
-    incrementCounters(rStates);
+  virtual std::vector<int> getRateDependencies() const
+  {
+    if (this->mSource_index < 0)
+      return {};
+    return {this->mSource_index};
+  }
+
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
+  {
+    gradient.clear();
+    if (this->mSource_index >= 0)
+      gradient.push_back(std::make_pair(this->mSource_index, this->mRate));
+  }
+
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    for (int b = 0; b < BATCH_LANES; b++)
+      unit_rates[b] = this->mSource_index >= 0 ? states[this->mSource_index * BATCH_LANES + b] : 0;
+    return (true);
   }
 };
 
@@ -142,22 +346,41 @@ public:
     : Transition(source_state, destination_state, parameter, governing_states)
     {}
 
-  virtual double getRate(state_values states)
+  virtual double getRate(const state_vector &states)
   {
-    double mass = 0;
-    for (std::vector<std::string>::iterator it = this->mGoverning_states.begin() ; it != this->mGoverning_states.end() ; it++)
-    {
-      mass += states[*it];
-    }
-    return (this->mParameters["parameter"] * states[this->mSource_state] * mass);
+    if (this->mSource_index < 0)
+      return (0);
+    return (this->mRate * states[this->mSource_index] * sumStates(this->mGoverning_indices, states));
   }
 
-  virtual void do_transition(double t, state_values &rStates)
+  virtual double getUnitRate(const state_vector &states) const
   {
-    rStates[this->mSource_state] -= 1;
-    rStates[this->mDestination_state] += 1;
+    if (this->mSource_index < 0)
+      return (0);
+    return (states[this->mSource_index] * sumStates(this->mGoverning_indices, states));
+  }
 
-    incrementCounters(rStates);
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
+  {
+    gradient.clear();
+    if (this->mSource_index < 0)
+      return;
+    gradient.push_back(std::make_pair(this->mSource_index, this->mRate * sumStates(this->mGoverning_indices, states)));
+    for (int i : this->mGoverning_indices)
+      gradient.push_back(std::make_pair(i, this->mRate * states[this->mSource_index]));
+  }
+
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    sumLanes(this->mGoverning_indices, states, unit_rates);
+    for (int b = 0; b < BATCH_LANES; b++)
+      unit_rates[b] *= this->mSource_index >= 0 ? states[this->mSource_index * BATCH_LANES + b] : 0;
+    return (true);
+  }
+
+  virtual int getOrder() const
+  {
+    return (2);
   }
 };
 
@@ -168,13 +391,6 @@ public:
   TransitionIndividualToVoid(std::string source_state, double parameter)
     : TransitionIndividual(source_state, "Void", parameter)
     {}
-  
-  virtual void do_transition(double t, state_values &rStates)
-  {
-    rStates[this->mSource_state] -= 1;
-
-    incrementCounters(rStates);
-  }
 };
 
 class TransitionIndividualFromVoid : public Transition
@@ -183,74 +399,151 @@ public:
   TransitionIndividualFromVoid(std::string destination_state, double parameter, std::vector<std::string> governing_states)
     : Transition("Void", destination_state, parameter, governing_states)
     {}
-  
-  virtual double getRate(state_values states)
+
+  virtual double getRate(const state_vector &states)
   {
-    double mass = 0;
-    for (std::vector<std::string>::iterator it = this->mGoverning_states.begin() ; it != this->mGoverning_states.end() ; it++)
-    {
-      mass += states[*it];
-    }
-    return (this->mParameters["parameter"] * mass);
+    return (this->mRate * sumStates(this->mGoverning_indices, states));
+  }
+
+  virtual double getUnitRate(const state_vector &states) const
+  {
+    return (sumStates(this->mGoverning_indices, states));
   }
 
-  virtual void do_transition(double t, state_values &rStates)
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
   {
-    rStates[this->mDestination_state] += 1;
+    gradient.clear();
+    for (int i : this->mGoverning_indices)
+      gradient.push_back(std::make_pair(i, this->mRate));
+  }
 
-    incrementCounters(rStates);
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    sumLanes(this->mGoverning_indices, states, unit_rates);
+    return (true);
   }
 };
 
+//Transition with a user-supplied rate. The rate is either a closure over the values of a declared
+//list of states (resolved to slots once, when the chain is compiled), or a legacy callback that is
+//handed every state by name. getRate fills scratch buffers held by the transition, so a compiled chain
+//must not be solved from two threads at once.
 class TransitionCustom : public Transition
 {
 public:
-  TransitionCustom(std::string source_state, std::string destination_state, parameter_map parameters, double (*getActualRate)(state_values pStates, parameter_map parameters))
+  //Receives the values of the declared rate states, in the order they were declared.
+  typedef std::function<double(const double *rate_states)> rate_function;
+
+private:
+  std::vector<std::string> mRateStates;
+  std::vector<int> mRate_indices;
+  state_vector mRateValues;
+  rate_function mRateFunction;
+
+  //Named view of the state vector handed to a legacy callback. Built once by compile(), in the same
+  //order as the index, and updated in place before each call.
+  state_values mNamedStates;
+
+public:
+  TransitionCustom(std::string source_state, std::string destination_state, parameter_map parameters, double (*getActualRate)(const state_values &states, const parameter_map &parameters))
     : Transition(source_state, destination_state, parameters, getActualRate)
     {}
 
-  virtual double getRate(state_values states)
+  TransitionCustom(std::string source_state, std::string destination_state, std::vector<std::string> rate_states, rate_function rate)
+    : Transition(source_state, destination_state, parameter_map(), nullptr), mRateStates(rate_states), mRateFunction(rate)
+    {}
+
+  virtual void compile(const state_index &index)
   {
-    return (this->mpGetActualRate(states, this->mParameters));
+    Transition::compile(index);
+    mRate_indices.clear();
+    for (const std::string &state : mRateStates)
+    {
+      mRate_indices.push_back(resolveState(index, state));
+    }
+    mRateValues.assign(mRate_indices.size(), 0);
+
+    mNamedStates.clear();
+    if (mRateFunction)
+      return;
+    for (auto &entry : index)
+    {
+      mNamedStates.emplace_hint(mNamedStates.end(), entry.first, 0);
+    }
   }
 
-  virtual void do_transition(double t, state_values &rStates)
+  virtual double getRate(const state_vector &states)
   {
-    rStates[this->mSource_state] -= 1;
-    rStates[this->mDestination_state] += 1;
+    if (mRateFunction)
+    {
+      for (int i = 0; i < mRate_indices.size(); i++)
+      {
+        mRateValues[i] = mRate_indices[i] >= 0 ? states[mRate_indices[i]] : 0;
+      }
+      return (mRateFunction(mRateValues.data()));
+    }
 
-    incrementCounters(rStates);
+    state_vector::const_iterator value = states.begin();
+    for (auto &entry : mNamedStates)
+    {
+      entry.second = *value++;
+    }
+    return (this->mpGetActualRate(mNamedStates, this->mParameters));
+  }
+
+  //A legacy callback may read any state.
+  virtual std::vector<int> getRateDependencies() const
+  {
+    if (mRateFunction)
+    {
+      std::vector<int> dependencies;
+      for (int i : mRate_indices)
+      {
+        if (i >= 0)
+          dependencies.push_back(i);
+      }
+      return (dependencies);
+    }
+    std::vector<int> dependencies(mNamedStates.size());
+    std::iota(dependencies.begin(), dependencies.end(), 0);
+    return (dependencies);
+  }
+
+  //The rate does not go through mRate, so there is no parameter to differentiate by.
+  virtual double getUnitRate(const state_vector &states) const
+  {
+    return (0);
+  }
+
+  //Unknown, so assume the worst case the leap condition is designed for.
+  virtual int getOrder() const
+  {
+    return (2);
   }
 };
 
 class TransitionCustomFromVoid : public TransitionCustom
 {
 public:
-  TransitionCustomFromVoid(std::string destination_state, parameter_map parameters, double (*getActualRate)(state_values pStates, parameter_map parameters))
+  TransitionCustomFromVoid(std::string destination_state, parameter_map parameters, double (*getActualRate)(const state_values &states, const parameter_map &parameters))
     : TransitionCustom("Void", destination_state, parameters, getActualRate)
     {}
 
-  virtual void do_transition(double t, state_values &rStates)
-  {
-    rStates[this->mDestination_state] += 1;
-
-    incrementCounters(rStates);
-  }
+  TransitionCustomFromVoid(std::string destination_state, std::vector<std::string> rate_states, rate_function rate)
+    : TransitionCustom("Void", destination_state, rate_states, rate)
+    {}
 };
 
 class TransitionCustomToVoid : public TransitionCustom
 {
 public:
-  TransitionCustomToVoid(std::string source_state, parameter_map parameters, double (*getActualRate)(state_values pStates, parameter_map parameters))
+  TransitionCustomToVoid(std::string source_state, parameter_map parameters, double (*getActualRate)(const state_values &states, const parameter_map &parameters))
     : TransitionCustom(source_state, "Void", parameters, getActualRate)
     {}
 
-  virtual void do_transition(double t, state_values &rStates)
-  {
-    rStates[this->mSource_state] -= 1;
-
-    incrementCounters(rStates);
-  }
+  TransitionCustomToVoid(std::string source_state, std::vector<std::string> rate_states, rate_function rate)
+    : TransitionCustom(source_state, "Void", rate_states, rate)
+    {}
 };
 
 
@@ -258,30 +551,73 @@ class TransitionMassActionByPopulation : public TransitionMassAction
 {
 private:
   std::vector<std::string> mPopulationStates;
+  std::vector<int> mPopulation_indices;
 public:
   TransitionMassActionByPopulation(std::string source_state, std::string destination_state, double parameter, std::vector<std::string> population_states, std::vector<std::string> governing_states = {})
     : TransitionMassAction(source_state, destination_state, parameter, governing_states), mPopulationStates(population_states)
     {}
 
-  virtual double getRate(state_values states)
+  virtual void compile(const state_index &index)
   {
-    double mass = 0;
-    for (std::vector<std::string>::iterator it = this->mGoverning_states.begin() ; it != this->mGoverning_states.end() ; it++)
-    {
-      mass += states[*it];
-    }
+    TransitionMassAction::compile(index);
+    mPopulation_indices = resolveStates(index, mPopulationStates);
+  }
 
-    double population_size = 0;
-    for (std::vector<std::string>::iterator it = mPopulationStates.begin() ; it != mPopulationStates.end() ; it++)
-    {
-      population_size += states[*it];
-    }
+  virtual std::vector<int> getRateDependencies() const
+  {
+    std::vector<int> dependencies = TransitionMassAction::getRateDependencies();
+    dependencies.insert(dependencies.end(), mPopulation_indices.begin(), mPopulation_indices.end());
+    return (dependencies);
+  }
+
+  virtual double getRate(const state_vector &states)
+  {
+    if (this->mSource_index < 0)
+      return (0);
+
+    double population_size = sumStates(mPopulation_indices, states);
     if (population_size == 0)
     {
       return (0);
     }
 
-    return ( (this->mParameters["parameter"] * states[this->mSource_state] * mass)/population_size );
+    return ( (this->mRate * states[this->mSource_index] * sumStates(this->mGoverning_indices, states))/population_size );
+  }
+
+  virtual double getUnitRate(const state_vector &states) const
+  {
+    double population_size = sumStates(mPopulation_indices, states);
+    if (population_size == 0)
+      return (0);
+    return (TransitionMassAction::getUnitRate(states) / population_size);
+  }
+
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
+  {
+    gradient.clear();
+    if (this->mSource_index < 0)
+      return;
+    double population_size = sumStates(mPopulation_indices, states);
+    if (population_size == 0)
+      return;
+
+    double source = states[this->mSource_index];
+    double governing = sumStates(this->mGoverning_indices, states);
+    gradient.push_back(std::make_pair(this->mSource_index, this->mRate * governing / population_size));
+    for (int i : this->mGoverning_indices)
+      gradient.push_back(std::make_pair(i, this->mRate * source / population_size));
+    for (int i : mPopulation_indices)
+      gradient.push_back(std::make_pair(i, -this->mRate * source * governing / (population_size * population_size)));
+  }
+
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    double population_sizes[BATCH_LANES];
+    sumLanes(mPopulation_indices, states, population_sizes);
+    TransitionMassAction::getUnitRates(states, unit_rates);
+    for (int b = 0; b < BATCH_LANES; b++)
+      unit_rates[b] = population_sizes[b] == 0 ? 0 : unit_rates[b] / population_sizes[b];
+    return (true);
   }
 };
 
@@ -291,8 +627,28 @@ class TransitionConstant : public TransitionIndividual
 public:
   TransitionConstant(std::string source_state, std::string destination_state, double parameter) : TransitionIndividual(source_state, destination_state, parameter) {}
 
-  virtual double getRate(state_values states)
+  virtual double getRate(const state_vector &states)
   {
-    return (this->mParameters["parameter"]*((double) states[this->mSource_state] > 0));
+    if (this->mSource_index < 0)
+      return (0);
+    return (this->mRate*((double) states[this->mSource_index] > 0));
+  }
+
+  virtual double getUnitRate(const state_vector &states) const
+  {
+    return (this->mSource_index >= 0 && states[this->mSource_index] > 0);
   }
-};
\ No newline at end of file
+
+  //A step in its source, so flat almost everywhere.
+  virtual void getRateGradient(const state_vector &states, std::vector<std::pair<int, double>> &gradient)
+  {
+    gradient.clear();
+  }
+
+  virtual bool getUnitRates(const double *states, double *unit_rates)
+  {
+    for (int b = 0; b < BATCH_LANES; b++)
+      unit_rates[b] = this->mSource_index >= 0 && states[this->mSource_index * BATCH_LANES + b] > 0;
+    return (true);
+  }
+};
@@ -6,8 +6,8 @@
 using namespace Rcpp;
 
 // chickens_model
-List chickens_model(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed);
-RcppExport SEXP _chickens_chickens_model(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP max_timeSEXP, SEXP dtSEXP, SEXP solver_typeSEXP, SEXP seedSEXP) {
+List chickens_model(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int equilibrium, List stop_conditions, RawVector checkpoint, std::string event_log);
+RcppExport SEXP _chickens_chickens_model(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP max_timeSEXP, SEXP dtSEXP, SEXP solver_typeSEXP, SEXP seedSEXP, SEXP equilibriumSEXP, SEXP stop_conditionsSEXP, SEXP checkpointSEXP, SEXP event_logSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -17,13 +17,192 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< double >::type dt(dtSEXP);
     Rcpp::traits::input_parameter< int >::type solver_type(solver_typeSEXP);
     Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
-    rcpp_result_gen = Rcpp::wrap(chickens_model(parameters_patch, betas, max_time, dt, solver_type, seed));
+    Rcpp::traits::input_parameter< int >::type equilibrium(equilibriumSEXP);
+    Rcpp::traits::input_parameter< List >::type stop_conditions(stop_conditionsSEXP);
+    Rcpp::traits::input_parameter< RawVector >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< std::string >::type event_log(event_logSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_model(parameters_patch, betas, max_time, dt, solver_type, seed, equilibrium, stop_conditions, checkpoint, event_log));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// chickens_replay_event_log
+List chickens_replay_event_log(List parameters_patch, NumericMatrix betas, std::string event_log, std::vector<double> times);
+RcppExport SEXP _chickens_chickens_replay_event_log(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP event_logSEXP, SEXP timesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch(parameters_patchSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type betas(betasSEXP);
+    Rcpp::traits::input_parameter< std::string >::type event_log(event_logSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type times(timesSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_replay_event_log(parameters_patch, betas, event_log, times));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// chickens_model_sensitivities
+List chickens_model_sensitivities(List parameters_patch, NumericMatrix betas, double max_time, double dt);
+RcppExport SEXP _chickens_chickens_model_sensitivities(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP max_timeSEXP, SEXP dtSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch(parameters_patchSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type betas(betasSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type dt(dtSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_model_sensitivities(parameters_patch, betas, max_time, dt));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// chickens_rate_gradient_error
+double chickens_rate_gradient_error(List parameters_patch, NumericMatrix betas);
+RcppExport SEXP _chickens_chickens_rate_gradient_error(SEXP parameters_patchSEXP, SEXP betasSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch(parameters_patchSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type betas(betasSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_rate_gradient_error(parameters_patch, betas));
+    return rcpp_result_gen;
+END_RCPP
+}
+// chickens_model_batch
+List chickens_model_batch(List parameters_patch_list, List betas_list, double max_time, double dt);
+RcppExport SEXP _chickens_chickens_model_batch(SEXP parameters_patch_listSEXP, SEXP betas_listSEXP, SEXP max_timeSEXP, SEXP dtSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch_list(parameters_patch_listSEXP);
+    Rcpp::traits::input_parameter< List >::type betas_list(betas_listSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type dt(dtSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_model_batch(parameters_patch_list, betas_list, max_time, dt));
+    return rcpp_result_gen;
+END_RCPP
+}
+// chickens_model_ensemble
+List chickens_model_ensemble(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int n_realisations, int n_threads, int equilibrium, List stop_conditions, RawVector checkpoint);
+RcppExport SEXP _chickens_chickens_model_ensemble(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP max_timeSEXP, SEXP dtSEXP, SEXP solver_typeSEXP, SEXP seedSEXP, SEXP n_realisationsSEXP, SEXP n_threadsSEXP, SEXP equilibriumSEXP, SEXP stop_conditionsSEXP, SEXP checkpointSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch(parameters_patchSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type betas(betasSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type dt(dtSEXP);
+    Rcpp::traits::input_parameter< int >::type solver_type(solver_typeSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_realisations(n_realisationsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type equilibrium(equilibriumSEXP);
+    Rcpp::traits::input_parameter< List >::type stop_conditions(stop_conditionsSEXP);
+    Rcpp::traits::input_parameter< RawVector >::type checkpoint(checkpointSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_model_ensemble(parameters_patch, betas, max_time, dt, solver_type, seed, n_realisations, n_threads, equilibrium, stop_conditions, checkpoint));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// chickens_model_ensemble_summary
+List chickens_model_ensemble_summary(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int n_realisations, int n_threads, std::vector<double> probabilities, int equilibrium, List stop_conditions, RawVector checkpoint);
+RcppExport SEXP _chickens_chickens_model_ensemble_summary(SEXP parameters_patchSEXP, SEXP betasSEXP, SEXP max_timeSEXP, SEXP dtSEXP, SEXP solver_typeSEXP, SEXP seedSEXP, SEXP n_realisationsSEXP, SEXP n_threadsSEXP, SEXP probabilitiesSEXP, SEXP equilibriumSEXP, SEXP stop_conditionsSEXP, SEXP checkpointSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type parameters_patch(parameters_patchSEXP);
+    Rcpp::traits::input_parameter< NumericMatrix >::type betas(betasSEXP);
+    Rcpp::traits::input_parameter< double >::type max_time(max_timeSEXP);
+    Rcpp::traits::input_parameter< double >::type dt(dtSEXP);
+    Rcpp::traits::input_parameter< int >::type solver_type(solver_typeSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_realisations(n_realisationsSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type probabilities(probabilitiesSEXP);
+    Rcpp::traits::input_parameter< int >::type equilibrium(equilibriumSEXP);
+    Rcpp::traits::input_parameter< List >::type stop_conditions(stop_conditionsSEXP);
+    Rcpp::traits::input_parameter< RawVector >::type checkpoint(checkpointSEXP);
+    rcpp_result_gen = Rcpp::wrap(chickens_model_ensemble_summary(parameters_patch, betas, max_time, dt, solver_type, seed, n_realisations, n_threads, probabilities, equilibrium, stop_conditions, checkpoint));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// write_binary_trajectory
+void write_binary_trajectory(DataFrame trajectory, std::string filename, bool single_precision);
+RcppExport SEXP _chickens_write_binary_trajectory(SEXP trajectorySEXP, SEXP filenameSEXP, SEXP single_precisionSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< DataFrame >::type trajectory(trajectorySEXP);
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< bool >::type single_precision(single_precisionSEXP);
+    write_binary_trajectory(trajectory, filename, single_precision);
+    return R_NilValue;
+END_RCPP
+}
+
+// read_binary_trajectory
+List read_binary_trajectory(std::string filename);
+RcppExport SEXP _chickens_read_binary_trajectory(SEXP filenameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_binary_trajectory(filename));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// write_delta_trajectory
+void write_delta_trajectory(DataFrame trajectory, std::string filename, bool compress);
+RcppExport SEXP _chickens_write_delta_trajectory(SEXP trajectorySEXP, SEXP filenameSEXP, SEXP compressSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< DataFrame >::type trajectory(trajectorySEXP);
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    Rcpp::traits::input_parameter< bool >::type compress(compressSEXP);
+    write_delta_trajectory(trajectory, filename, compress);
+    return R_NilValue;
+END_RCPP
+}
+
+// read_delta_trajectory
+List read_delta_trajectory(std::string filename);
+RcppExport SEXP _chickens_read_delta_trajectory(SEXP filenameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filename(filenameSEXP);
+    rcpp_result_gen = Rcpp::wrap(read_delta_trajectory(filename));
+    return rcpp_result_gen;
+END_RCPP
+}
+
+// philox_block
+NumericVector philox_block(NumericVector key, NumericVector counter);
+RcppExport SEXP _chickens_philox_block(SEXP keySEXP, SEXP counterSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< NumericVector >::type key(keySEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type counter(counterSEXP);
+    rcpp_result_gen = Rcpp::wrap(philox_block(key, counter));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_chickens_chickens_model", (DL_FUNC) &_chickens_chickens_model, 6},
+    {"_chickens_chickens_model", (DL_FUNC) &_chickens_chickens_model, 10},
+    {"_chickens_chickens_replay_event_log", (DL_FUNC) &_chickens_chickens_replay_event_log, 4},
+    {"_chickens_chickens_model_sensitivities", (DL_FUNC) &_chickens_chickens_model_sensitivities, 4},
+    {"_chickens_chickens_rate_gradient_error", (DL_FUNC) &_chickens_chickens_rate_gradient_error, 2},
+    {"_chickens_chickens_model_batch", (DL_FUNC) &_chickens_chickens_model_batch, 4},
+    {"_chickens_chickens_model_ensemble", (DL_FUNC) &_chickens_chickens_model_ensemble, 11},
+    {"_chickens_chickens_model_ensemble_summary", (DL_FUNC) &_chickens_chickens_model_ensemble_summary, 12},
+    {"_chickens_write_binary_trajectory", (DL_FUNC) &_chickens_write_binary_trajectory, 3},
+    {"_chickens_read_binary_trajectory", (DL_FUNC) &_chickens_read_binary_trajectory, 1},
+    {"_chickens_write_delta_trajectory", (DL_FUNC) &_chickens_write_delta_trajectory, 3},
+    {"_chickens_read_delta_trajectory", (DL_FUNC) &_chickens_read_delta_trajectory, 1},
+    {"_chickens_philox_block", (DL_FUNC) &_chickens_philox_block, 2},
     {NULL, NULL, 0}
 };
 
@@ -3,6 +3,7 @@
 #include <vector>
 #include <Rcpp.h>
 #include <algorithm>
+#include <memory>
 #include "MarkovChainSimulator/MarkovChain/MarkovChain.hpp"
 
 typedef std::map<std::string, double> stringmap;
@@ -31,84 +32,68 @@ public:
   WithinPatchParameters() {}
 };
 
-class ModelChickenFlu {
+//Carrying-capacity balance of one patch: the fraction alpha of maturing eggs that hatch (the rest are
+//sold) and the number rho of birds imported to hold the patch at K. Shared by the patch's four
+//hatching transitions, which pass it the patch's population states followed by its egg count, and
+//only recomputed when one of those has changed since the last call.
+class HatchingBalance
+{
+private:
+  double mN1;
+  double mK;
+  std::vector<double> mDeathRates;
+  std::vector<double> mLastInputs;
+  bool mValid = false;
   
-private:   
-  static double eggHatchingRate(state_values states, parameter_map parameters) {
-    //Calculate n_1*E and total sum of death rates.
-    std::string patchname;
-    if (parameters["Sc"] == 1)
-      patchname = "Sc";
-    if (parameters["Ns"] == 1)
-      patchname = "Ns";
-    if (parameters["Es"] == 1)
-      patchname = "Es";
-    if (parameters["Bs"] == 1)
-      patchname = "Bs";
+  double mAlpha = 0;
+  double mRho = 0;
+  double mN1E = 0;
+  
+public:
+  HatchingBalance(double n1, double K, std::vector<double> death_rates) :
+    mN1(n1), mK(K), mDeathRates(death_rates), mLastInputs(death_rates.size() + 1, 0) {}
+  
+  void update(const double *inputs)
+  {
+    int num_population_states = mDeathRates.size();
+    if (mValid && std::equal(mLastInputs.begin(), mLastInputs.end(), inputs))
+      return;
+    std::copy(inputs, inputs + num_population_states + 1, mLastInputs.begin());
+    mValid = true;
     
     double population_size = 0;
-    for (state_values::iterator it = states.begin() ; it != states.end() ; it++) 
-    {
-      std::string s = it->first;
-      std::string delimeter = ".";
-      std::string current_patch = s.substr(0, s.find(delimeter));
-      s.erase(0, s.find(delimeter) + delimeter.length());
-      std::string state = s.substr(0, s.find(delimeter));
-      size_t n = std::count(s.begin(), s.end(), '.');
-      if (n > 0 && current_patch == patchname) 
-      {
-        population_size = population_size + it->second;
-      }
-    }
-    
-    double n1E = parameters["n1"]*states[patchname+".E"];
     double totaldeaths = 0;
-    
-    std::vector<std::string> disease_states = {"S","E","I"};
-    for (std::string disease_state : disease_states)
+    for (int i = 0 ; i < num_population_states ; i++)
     {
-      totaldeaths += states[patchname+".Ch."+disease_state] * parameters["delta1"];
-      totaldeaths += states[patchname+".eG."+disease_state] * parameters["delta2"];
-      totaldeaths += states[patchname+".lG."+disease_state] * parameters["alphaLG"];
-      totaldeaths += states[patchname+".lG."+disease_state] * (1-parameters["alphaLG"])*parameters["delta3"];
-      totaldeaths += states[patchname+".He."+disease_state] * parameters["alphaHe"];
-      totaldeaths += states[patchname+".He."+disease_state] * (1-parameters["alphaHe"])*parameters["delta3"];
-      totaldeaths += states[patchname+".Rs."+disease_state] * parameters["alphaRs"];
-      totaldeaths += states[patchname+".Rs."+disease_state] * (1-parameters["alphaRs"])*parameters["delta4"];
+      population_size += inputs[i];
+      totaldeaths += inputs[i] * mDeathRates[i];
     }
     
-    double alpha = 0;
-    double rho = 0;
-    if (population_size + n1E - totaldeaths <= parameters["K"])
+    mN1E = mN1*inputs[num_population_states];
+    if (population_size + mN1E - totaldeaths <= mK)
     {
-      alpha = 1;
-      rho = parameters["K"] - population_size - n1E + totaldeaths;
+      mAlpha = 1;
+      mRho = mK - population_size - mN1E + totaldeaths;
     }
     else
     {
-      rho = 0;
-      alpha = (parameters["K"] - population_size + totaldeaths)/n1E;
-      if (alpha > 1)
-        alpha = 1;
-      if (alpha < 0 || std::isinf(alpha))
-        alpha = 0;
+      mRho = 0;
+      mAlpha = (mK - population_size + totaldeaths)/mN1E;
+      if (mAlpha > 1)
+        mAlpha = 1;
+      if (mAlpha < 0 || std::isinf(mAlpha))
+        mAlpha = 0;
     }
-    
-    if (parameters["returnrho"])
-    {
-      if (parameters["Ch.S"] == 1)
-        return (parameters["y"]*rho); 
-      else
-        return ((1-parameters["y"])*rho);
-    }
-    
-    if (parameters["returnhatching"])
-      return (alpha*n1E);
-    
-    if (parameters["returnsold"])
-      return ((1-alpha)*n1E);
   }
   
+  double getAlpha() const { return (mAlpha); }
+  double getRho() const { return (mRho); }
+  double getN1E() const { return (mN1E); }
+};
+
+class ModelChickenFlu {
+  
+private:   
   std::map<std::string, WithinPatchParameters> mPatchParams; 
   std::vector<std::string> mPatchNames;
   
@@ -117,6 +102,23 @@ public:
   ModelChickenFlu(std::vector<std::string> patchNames, std::map<std::string, WithinPatchParameters> patchParams) :
   mPatchParams(patchParams), mPatchNames(patchNames) {}
   
+  //Exposed and infectious compartments of every patch. Holding these at zero when looking for an
+  //equilibrium gives the disease-free one.
+  std::vector<std::string> getInfectedStates() const
+  {
+    const std::vector<std::string> demographic_states = {"Ch","eG","lG","He","Rs"};
+    std::vector<std::string> infected;
+    for (std::string patchName : mPatchNames)
+    {
+      for (std::string demographic_state : demographic_states)
+      {
+        infected.push_back(patchName + "." + demographic_state + ".E");
+        infected.push_back(patchName + "." + demographic_state + ".I");
+      }
+    }
+    return (infected);
+  }
+  
   void setupModel(MarkovChain &rChain) {
     
     const std::vector<std::string> disease_states = {"S", "E", "I"};
@@ -156,34 +158,41 @@ public:
       }
       
       //Aging transitions
-      parameter_map hatchingParameters;
-      hatchingParameters[patchName] = 1;
-      hatchingParameters["n1"]=mPatchParams[patchName].mN[1];
-      hatchingParameters["delta1"]=mPatchParams[patchName].mDelta[1];
-      hatchingParameters["delta2"]=mPatchParams[patchName].mDelta[2];
-      hatchingParameters["delta3"]=mPatchParams[patchName].mDelta[3];
-      hatchingParameters["delta4"]=mPatchParams[patchName].mDelta[4];
-      hatchingParameters["alphaLG"]=mPatchParams[patchName].mAlpha["lG"];
-      hatchingParameters["alphaHe"]=mPatchParams[patchName].mAlpha["He"];
-      hatchingParameters["alphaRs"]=mPatchParams[patchName].mAlpha["Rs"];
-      hatchingParameters["returnhatching"]=1;
-      hatchingParameters["K"]=initial_size;
-      hatchingParameters["y"]=mPatchParams[patchName].mY;
-      hatchingParameters["Ch.S"]=1;
+      std::vector<double> death_rates;
+      for (std::string demographic_state : demographic_states) 
+      {
+        double death_rate = 0;
+        if (demographic_state == "Ch")
+          death_rate = mPatchParams[patchName].mDelta[1];
+        if (demographic_state == "eG")
+          death_rate = mPatchParams[patchName].mDelta[2];
+        if (demographic_state == "lG")
+          death_rate = mPatchParams[patchName].mAlpha["lG"] + (1-mPatchParams[patchName].mAlpha["lG"])*mPatchParams[patchName].mDelta[3];
+        if (demographic_state == "He")
+          death_rate = mPatchParams[patchName].mAlpha["He"] + (1-mPatchParams[patchName].mAlpha["He"])*mPatchParams[patchName].mDelta[3];
+        if (demographic_state == "Rs")
+          death_rate = mPatchParams[patchName].mAlpha["Rs"] + (1-mPatchParams[patchName].mAlpha["Rs"])*mPatchParams[patchName].mDelta[4];
+        for (std::string disease_state : disease_states)
+          death_rates.push_back(death_rate);
+      }
+      double y = mPatchParams[patchName].mY;
+      std::shared_ptr<HatchingBalance> balance = std::make_shared<HatchingBalance>(mPatchParams[patchName].mN[1], initial_size, death_rates);
+      std::vector<std::string> hatching_states = within_patch_population_states;
+      hatching_states.push_back(patchName+".E");
       
-      rChain.addTransition(new TransitionCustom(patchName+".E", patchName+".Ch.S", hatchingParameters, *eggHatchingRate));
-
+      rChain.addTransition(new TransitionCustom(patchName+".E", patchName+".Ch.S", hatching_states,
+                                                [balance](const double *x) { balance->update(x); return (balance->getAlpha()*balance->getN1E()); }));
       
-      hatchingParameters["returnsold"]=1; hatchingParameters["returnhatching"]=0;
-      rChain.addTransition(new TransitionCustomToVoid(patchName+".E", hatchingParameters, *eggHatchingRate));
+      rChain.addTransition(new TransitionCustomToVoid(patchName+".E", hatching_states,
+                                                      [balance](const double *x) { balance->update(x); return ((1-balance->getAlpha())*balance->getN1E()); }));
       
-      hatchingParameters["returnrho"]=1; hatchingParameters["returnsold"]=0;
-      TransitionCustomFromVoid* import_chicks = new TransitionCustomFromVoid(patchName+".Ch.S", hatchingParameters, *eggHatchingRate);
+      TransitionCustomFromVoid* import_chicks = new TransitionCustomFromVoid(patchName+".Ch.S", hatching_states,
+                                                                             [balance, y](const double *x) { balance->update(x); return (y*balance->getRho()); });
       import_chicks->addCounter(patchName+".importedChicks");
       rChain.addTransition(import_chicks);
 
-      hatchingParameters["Ch.S"]=0;
-      TransitionCustomFromVoid* import_hens = new TransitionCustomFromVoid(patchName+".He.S", hatchingParameters, *eggHatchingRate);
+      TransitionCustomFromVoid* import_hens = new TransitionCustomFromVoid(patchName+".He.S", hatching_states,
+                                                                           [balance, y](const double *x) { balance->update(x); return ((1-y)*balance->getRho()); });
       import_hens->addCounter(patchName+".importedHens");
       rChain.addTransition(import_hens);
       
@@ -194,8 +203,12 @@ public:
         //Ageing
         rChain.addTransition(new TransitionIndividual(patchName+".Ch."+disease_state, patchName+".eG."+disease_state, mPatchParams[patchName].mN[1]));
         rChain.addTransition(new TransitionIndividual(patchName+".eG."+disease_state, patchName+".lG."+disease_state, 2*mPatchParams[patchName].mN[2]));
-        rChain.addTransition(new TransitionIndividual(patchName+".lG."+disease_state, patchName+".He."+disease_state, 2*mPatchParams[patchName].mX*mPatchParams[patchName].mN[2]));
-        rChain.addTransition(new TransitionIndividual(patchName+".lG."+disease_state, patchName+".Rs."+disease_state, 2*(1-mPatchParams[patchName].mX)*mPatchParams[patchName].mN[2]));
+        TransitionIndividual* to_hens = new TransitionIndividual(patchName+".lG."+disease_state, patchName+".He."+disease_state, 2*mPatchParams[patchName].mX*mPatchParams[patchName].mN[2]);
+        rChain.addTransition(to_hens);
+        rChain.addSensitivity(patchName+".x", to_hens, 2*mPatchParams[patchName].mN[2]);
+        TransitionIndividual* to_roosters = new TransitionIndividual(patchName+".lG."+disease_state, patchName+".Rs."+disease_state, 2*(1-mPatchParams[patchName].mX)*mPatchParams[patchName].mN[2]);
+        rChain.addTransition(to_roosters);
+        rChain.addSensitivity(patchName+".x", to_roosters, -2*mPatchParams[patchName].mN[2]);
         
         //Death
         rChain.addTransition(new TransitionIndividualToVoid(patchName+".Ch."+disease_state, mPatchParams[patchName].mDelta[1]));
@@ -211,7 +224,9 @@ public:
 
       //New egg laying rate from discussion on 10/08/18
       std::vector<std::string> governing_states = {patchName+".He.S", patchName+".He.E"};
-      rChain.addTransition(new TransitionIndividualFromVoid(patchName+".E", mPatchParams[patchName].mNEgg * mPatchParams[patchName].mBr / 365.0, governing_states));
+      TransitionIndividualFromVoid* egg_laying = new TransitionIndividualFromVoid(patchName+".E", mPatchParams[patchName].mNEgg * mPatchParams[patchName].mBr / 365.0, governing_states);
+      rChain.addTransition(egg_laying);
+      rChain.addSensitivity(patchName+".n_egg", egg_laying, mPatchParams[patchName].mBr / 365.0);
       
       std::vector<std::string> infected_states = {"Ch.I", "eG.I", "lG.I", "He.I", "Rs.I"};
       for (int i = 0 ; i < infected_states.size() ; i++)
@@ -222,12 +237,20 @@ public:
       for (std::string demographic_state : demographic_states)
       {
         //Within patch:
+        //The infection chain is always simulated as exact jumps by the hybrid solver.
         TransitionMassActionByPopulation* infection_transition = new TransitionMassActionByPopulation(patchName +"." + demographic_state+".S", patchName + "." + demographic_state+".E", mPatchParams[patchName].mBeta[patchName], within_patch_population_states, infected_states);
+        infection_transition->setPartition(Transition::PARTITION_SLOW);
         rChain.addTransition(infection_transition);
+        rChain.addSensitivity(patchName+".beta."+patchName, infection_transition, 1);
         TransitionIndividual* incidence_transition = new TransitionIndividual(patchName + "." + demographic_state+".E", patchName + "." + demographic_state+".I", mPatchParams[patchName].mSigma);
         incidence_transition->addCounter(patchName+".infection");
+        incidence_transition->setPartition(Transition::PARTITION_SLOW);
         rChain.addTransition(incidence_transition);
-        rChain.addTransition(new TransitionIndividualToVoid(patchName + "." + demographic_state+".I", mPatchParams[patchName].mGamma));
+        rChain.addSensitivity(patchName+".sigma", incidence_transition, 1);
+        TransitionIndividualToVoid* removal_transition = new TransitionIndividualToVoid(patchName + "." + demographic_state+".I", mPatchParams[patchName].mGamma);
+        removal_transition->setPartition(Transition::PARTITION_SLOW);
+        rChain.addTransition(removal_transition);
+        rChain.addSensitivity(patchName+".gamma", removal_transition, 1);
       }
     }
 
@@ -257,7 +280,9 @@ public:
             }
 
             TransitionMassActionByPopulation* infection_transition = new TransitionMassActionByPopulation(patchName+"."+demographic_state+".S", patchName+"."+demographic_state+".E", mPatchParams[patchName].mBeta[other_patch], denominator_states, infected_states);
+            infection_transition->setPartition(Transition::PARTITION_SLOW);
             rChain.addTransition(infection_transition);
+            rChain.addSensitivity(patchName+".beta."+other_patch, infection_transition, 1);
           }
         }
       }
@@ -1,85 +1,132 @@
 #include <Rcpp.h>
 // [[Rcpp::plugins(cpp11)]]
 #include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
 #include "MarkovChainSimulator/MarkovChain/MarkovChain.hpp"
 #include "MarkovChainSimulator/MarkovChain/MarkovChain.cpp"
 #include "MarkovChainSimulator/MarkovChain/Serialiser.hpp"
 #include "MarkovChainSimulator/MarkovChain/Serialiser.cpp"
+#include "MarkovChainSimulator/MarkovChain/BinaryTrajectoryReader.hpp"
+#include "MarkovChainSimulator/MarkovChain/DeltaTrajectoryReader.hpp"
+#include "MarkovChainSimulator/MarkovChain/EventLog.hpp"
+#include "MarkovChainSimulator/MarkovChain/EventLog.cpp"
+#include "MarkovChainSimulator/MarkovChain/EnsembleSummary.hpp"
+#include "MarkovChainSimulator/MarkovChain/EnsembleSummary.cpp"
 #include "modeldefs.cpp"
 using namespace Rcpp;
 
+//Samples a run on its output grid straight into R columns, one per state plus "t". The columns are
+//allocated for the whole grid once the states are known, each state's column is resolved once, and
+//getResults hands them back as a data frame without copying. R memory may only be touched from R's
+//own thread, so the ensembles keep sampling into SerialiserPredefinedTimesMemory.
 class SerialiserR : public Serialiser {
   
 private:
-  std::map<std::string, std::vector<double>> mResults;
-  std::vector<double> mSerialiseTimes;
-  state_values mLastState;
-  double mLastT;
-  bool shouldInterpolate = true;
+  GridSampler mGrid;
+  int mSize;
+  int mRows = 0;
+  bool mShouldInterpolate = true;
+  List mColumns;
+  CharacterVector mNames;
+  double *mpTimes = NULL;
+  std::vector<double *> mStateColumns;
+  std::vector<double> mLastState;
+  double mLastT = 0;
+  
 public:
   
-  SerialiserR(std::vector<double> serialiseTimes) : mSerialiseTimes(serialiseTimes) {}
+  SerialiserR(std::vector<double> serialiseTimes) : mGrid(serialiseTimes), mSize(serialiseTimes.size()) {}
   
   void setShouldInterpolate(bool status)
   {
-    shouldInterpolate = status;
+    mShouldInterpolate = status;
+  }
+  
+  virtual double getNextTime() const
+  {
+    return (mGrid.next());
   }
   
-  virtual void serialise(double t, state_values states)
+  virtual void serialiseHeader(const state_index &schema)
   {
-    double next_time = *mSerialiseTimes.begin();
-    while (t > next_time && !mSerialiseTimes.empty())
+    setSchema(schema);
+    //Columns are in name order, as the states are in the schema, with "t" among them.
+    std::vector<std::string> names = {"t"};
+    names.insert(names.end(), getNames().begin(), getNames().end());
+    std::sort(names.begin(), names.end());
+    
+    mColumns = List(names.size());
+    mNames = CharacterVector(names.size());
+    mStateColumns.clear();
+    for (int c = 0; c < names.size(); c++)
     {
-      state_values interpolated_states;
-      if (shouldInterpolate)
-      {
-        for (auto &p : states)
-        {
-          double slope = ( (double) p.second - mLastState[p.first]) / (t - mLastT);
-          interpolated_states[p.first] = slope * (next_time - mLastT) + mLastState[p.first];
-        }
-      } else
+      NumericVector column(mSize);
+      mColumns[c] = column;
+      mNames[c] = names[c];
+      if (names[c] == "t")
+        mpTimes = column.begin();
+      else
+        mStateColumns.push_back(column.begin());
+    }
+    mLastState.clear();
+  }
+  
+  virtual void serialise(double t, const double *values)
+  {
+    const std::vector<int> &slots = getSlots();
+    //Output times before the first state get that state.
+    if (mLastState.empty())
+    {
+      mLastState.assign(values, values + slots.size());
+      mLastT = t;
+    }
+    while (t > mGrid.next())
+    {
+      double next_time = mGrid.next();
+      for (int c = 0; c < slots.size(); c++)
       {
-        for (auto &p : states)
+        double value = mLastState[slots[c]];
+        if (mShouldInterpolate && t > mLastT)
         {
-          interpolated_states[p.first] = mLastState[p.first];
+          double slope = (values[slots[c]] - mLastState[slots[c]]) / (t - mLastT);
+          value = slope * (next_time - mLastT) + mLastState[slots[c]];
         }
+        mStateColumns[c][mRows] = value;
       }
-      mResults["t"].push_back(next_time);
-      for (auto& state : interpolated_states)
-      {
-        mResults[state.first].push_back(state.second);
-      }
-      mSerialiseTimes.erase(mSerialiseTimes.begin());
-      next_time = *mSerialiseTimes.begin();
+      mpTimes[mRows] = next_time;
+      mRows++;
+      mGrid.advance();
     }
-    mLastState = states;
+    mLastState.assign(values, values + slots.size());
     mLastT = t;
-    
   }
   
-  virtual void serialiseHeader(state_values states)
+  virtual void serialiseFinally(double t, const double *values)
   {
-  }
-  
-  virtual void serialiseFinally(double t, state_values states)
-  {
-    serialise(t, states);
+    serialise(t, values);
   }
   
   List getResults()
   {
-    List list(mResults.size());
-    CharacterVector namevec;
-    int i = 0;
-    for (auto& result : mResults)
+    //Output times past the end of the run, if any, were never reached.
+    if (mRows < mSize)
     {
-      namevec.push_back(result.first);
-      list[i] = result.second;
-      i++;
+      for (int c = 0; c < mColumns.size(); c++)
+      {
+        NumericVector column = mColumns[c];
+        mColumns[c] = NumericVector(column.begin(), column.begin() + mRows);
+      }
     }
-    list.attr("names") = namevec;
-    return list;
+    mColumns.attr("names") = mNames;
+    mColumns.attr("class") = "data.frame";
+    mColumns.attr("row.names") = IntegerVector::create(NA_INTEGER, -mRows);
+    return (mColumns);
   }
   
 };
@@ -96,14 +143,8 @@ std::map<std::string, double> convertListToMap(List list)
   return (ret);
 }
 
-// [[Rcpp::export(.chickens_model)]]
-List chickens_model(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed) {
-  //parameters_patch contains the within-patch parameters
-  //betas is the mixing matrix, which is named.
-  
-  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
-  //Can access each set of within-patch parameters using patchNames now.
-  
+std::map<std::string, WithinPatchParameters> convertPatchParameters(List parameters_patch, NumericMatrix betas, std::vector<std::string> patchNames)
+{
   std::map<std::string, WithinPatchParameters> param_map;
   
   int i = 0;
@@ -135,23 +176,531 @@ List chickens_model(List parameters_patch, NumericMatrix betas, double max_time,
     i++;
   }
   
-  std::vector<double> serialiser_times(max_time/dt + 1);
-  double n = {-1 * dt};
+  return (param_map);
+}
+
+std::vector<double> makeSerialiserTimes(double start_time, double max_time, double dt)
+{
+  std::vector<double> serialiser_times(std::max((max_time - start_time)/dt + 1, 0.0));
+  double n = {start_time - dt};
   std::generate(serialiser_times.begin(), serialiser_times.end(), [&n, dt] { return n+=dt;});
-  SerialiserR serialiser(serialiser_times);
-  if (solver_type == -1)
+  return (serialiser_times);
+}
+
+//equilibrium is 0 to start from x0, 1 to start from the disease-free equilibrium (with the infected
+//compartments of x0 added back), and 2 to also draw stochastic realisations around that equilibrium.
+//Ensemble workers call this too, so a failed search throws a standard exception rather than calling stop().
+void startAtEquilibrium(MarkovChain &chain, const ModelChickenFlu &model, int equilibrium)
+{
+  const int max_iterations = 1000;
+  if (equilibrium <= 0)
+    return;
+  if (!chain.findEquilibrium(model.getInfectedStates(), max_iterations))
+    throw std::runtime_error("No disease-free equilibrium found within " + std::to_string(max_iterations) + " iterations");
+  chain.setDrawInitialStates(equilibrium == 2);
+}
+
+//The time a run from checkpoint starts at: 0 without one. A malformed checkpoint also starts at 0,
+//and is reported when the chain fails to restore it.
+double checkpointStartTime(const std::string &checkpoint)
+{
+  double start_time = checkpoint.empty() ? 0 : MarkovChain::getCheckpointTime(checkpoint);
+  return (std::isnan(start_time) ? 0 : start_time);
+}
+
+//Starts the chain from a checkpoint of an earlier run, if one is given. The infected states of x0
+//replace the checkpoint's, so infection can be introduced into a population that was simulated
+//without it. A forked run draws from its own branch of the checkpoint's random number stream, and
+//any other run continues that stream.
+void startFromCheckpoint(MarkovChain &chain, const ModelChickenFlu &model, const std::string &checkpoint, bool fork, uint64_t branch)
+{
+  if (checkpoint.empty())
+    return;
+  if (fork)
+    chain.forkCheckpoint(checkpoint, branch, model.getInfectedStates());
+  else
+    chain.restoreCheckpoint(checkpoint, model.getInfectedStates());
+}
+
+//A stopping condition as passed from R: the summed states, the threshold and its direction. The state
+//"infected" stands for every exposed and infectious state of the model, so states = "infected" with
+//threshold 0 stops a run once the infection has died out.
+struct StoppingCondition
+{
+  std::vector<std::string> states;
+  double threshold;
+  bool above;
+};
+
+std::vector<StoppingCondition> convertStoppingConditions(List stop_conditions)
+{
+  std::vector<StoppingCondition> conditions;
+  for (int i = 0; i < stop_conditions.size(); i++)
+  {
+    List sublist = stop_conditions[i];
+    StoppingCondition condition;
+    condition.states = as<std::vector<std::string>>(sublist["states"]);
+    condition.threshold = as<double>(sublist["threshold"]);
+    condition.above = as<bool>(sublist["above"]);
+    conditions.push_back(condition);
+  }
+  return (conditions);
+}
+
+void addStoppingConditions(MarkovChain &chain, const ModelChickenFlu &model, const std::vector<StoppingCondition> &conditions)
+{
+  for (const StoppingCondition &condition : conditions)
+  {
+    std::vector<std::string> states;
+    for (const std::string &state : condition.states)
+    {
+      if (state == "infected")
+      {
+        std::vector<std::string> infected = model.getInfectedStates();
+        states.insert(states.end(), infected.begin(), infected.end());
+      }
+      else
+        states.push_back(state);
+    }
+    chain.addStoppingCondition(states, condition.threshold, condition.above);
+  }
+}
+
+// [[Rcpp::export(.chickens_model)]]
+List chickens_model(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int equilibrium, List stop_conditions, RawVector checkpoint, std::string event_log) {
+  //parameters_patch contains the within-patch parameters
+  //betas is the mixing matrix, which is named.
+  
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  //Can access each set of within-patch parameters using patchNames now.
+  
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  std::string start(checkpoint.begin(), checkpoint.end());
+  
+  SerialiserR serialiser(makeSerialiserTimes(checkpointStartTime(start), max_time, dt));
+  if (MarkovChain::isStochastic(solver_type))
     serialiser.setShouldInterpolate(false);
     
   MarkovChain chain;
   if (seed != -1)
-    chain.setSeed(seed);
+    chain.setSeed((uint32_t) seed);
   chain.setSerialiser(&serialiser);
   chain.setMaxTime(max_time);
+  std::unique_ptr<EventLogWriter> log;
+  if (!event_log.empty())
+  {
+    if (solver_type != MarkovChain::SOLVER_TYPE_GILLESPIE && solver_type != MarkovChain::SOLVER_TYPE_NEXT_REACTION)
+      stop("Only the \"stochastic\" and \"next_reaction\" solvers can log events");
+    log.reset(new EventLogWriter(event_log));
+    chain.setEventLog(log.get());
+  }
   
   ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
   model.setupModel(chain);
+  chain.compile();
+  if (start.empty())
+    startAtEquilibrium(chain, model, equilibrium);
+  //With a seed, the run is the first realisation of an ensemble forked from the checkpoint.
+  startFromCheckpoint(chain, model, start, seed != -1, (uint64_t)(uint32_t) seed << 32);
+  addStoppingConditions(chain, model, convertStoppingConditions(stop_conditions));
   chain.solve(solver_type);
   
   chain.cleanup();
+  std::string end = chain.getCheckpoint();
+  return (List::create(Named("realisation") = serialiser.getResults(),
+                       Named("stopping_time") = chain.getStoppingTime(),
+                       Named("checkpoint") = RawVector(end.begin(), end.end())));
+}
+
+// [[Rcpp::export(.chickens_replay_event_log)]]
+List chickens_replay_event_log(List parameters_patch, NumericMatrix betas, std::string event_log, std::vector<double> times) {
+  //Only the model's structure matters for the replay, so any parameters with the logged run's patches will do.
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  
+  SerialiserR serialiser(times);
+  serialiser.setShouldInterpolate(false);
+  
+  MarkovChain chain;
+  ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
+  model.setupModel(chain);
+  chain.compile();
+  bool replayed = chain.replayEventLog(event_log, &serialiser, times.empty() ? 0 : times.front());
+  chain.cleanup();
+  if (!replayed)
+    stop("Could not replay event log " + event_log);
+  
   return (serialiser.getResults());
 }
+
+// [[Rcpp::export(.chickens_model_sensitivities)]]
+List chickens_model_sensitivities(List parameters_patch, NumericMatrix betas, double max_time, double dt) {
+  //One augmented deterministic solve gives the states and their derivatives with respect to every
+  //parameter the model registers (beta, sigma, gamma, n_egg and x of each patch).
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  
+  std::vector<double> serialiser_times = makeSerialiserTimes(0, max_time, dt);
+  SerialiserR serialiser(serialiser_times);
+  
+  MarkovChain chain;
+  chain.setSerialiser(&serialiser);
+  chain.setMaxTime(max_time);
+  
+  ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
+  model.setupModel(chain);
+  chain.compile();
+  
+  std::vector<std::string> parameters = chain.getSensitivityParameters();
+  std::vector<SerialiserR> sensitivity_serialisers(parameters.size(), SerialiserR(serialiser_times));
+  std::vector<Serialiser*> pointers;
+  for (SerialiserR &sensitivity_serialiser : sensitivity_serialisers)
+    pointers.push_back(&sensitivity_serialiser);
+  chain.solveSensitivities(pointers);
+  chain.cleanup();
+  
+  List sensitivities(parameters.size());
+  for (int k = 0; k < parameters.size(); k++)
+    sensitivities[k] = sensitivity_serialisers[k].getResults();
+  sensitivities.attr("names") = parameters;
+  
+  return (List::create(Named("realisation") = serialiser.getResults(),
+                       Named("sensitivities") = sensitivities));
+}
+
+// [[Rcpp::export(.chickens_rate_gradient_error)]]
+double chickens_rate_gradient_error(List parameters_patch, NumericMatrix betas) {
+  //Checks the model's closed-form rate gradients against differences of its rates, at x0.
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  
+  MarkovChain chain;
+  ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
+  model.setupModel(chain);
+  chain.compile();
+  double error = chain.getRateGradientError();
+  chain.cleanup();
+  return (error);
+}
+
+// [[Rcpp::export(.chickens_model_batch)]]
+List chickens_model_batch(List parameters_patch_list, List betas_list, double max_time, double dt) {
+  //Deterministic runs of one model under many parameter sets, integrated together. Every set must
+  //name the same patches, so that the chains share their structure.
+  std::vector<double> serialiser_times = makeSerialiserTimes(0, max_time, dt);
+  int num_sets = parameters_patch_list.size();
+
+  std::vector<MarkovChain> chains(num_sets);
+  std::vector<SerialiserR> serialisers(num_sets, SerialiserR(serialiser_times));
+  std::vector<MarkovChain*> pointers;
+  for (int k = 0; k < num_sets; k++)
+  {
+    NumericMatrix betas = as<NumericMatrix>(betas_list[k]);
+    std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+    std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(as<List>(parameters_patch_list[k]), betas, patchNames);
+
+    chains[k].setSerialiser(&serialisers[k]);
+    chains[k].setMaxTime(max_time);
+    ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
+    model.setupModel(chains[k]);
+    chains[k].compile();
+    pointers.push_back(&chains[k]);
+  }
+
+  MarkovChain::solveBatch(pointers);
+
+  List realisations(num_sets);
+  for (int k = 0; k < num_sets; k++)
+  {
+    chains[k].cleanup();
+    realisations[k] = serialisers[k].getResults();
+  }
+  return (realisations);
+}
+
+//Runs realisations 0..num_realisations-1 on a pool of worker threads. Each worker builds its own chain
+//and takes realisations off a shared counter; realisation r draws from the RNG stream (seed, r), so the
+//results do not depend on the number of threads or on which thread ran which realisation. Starting
+//from a checkpoint, realisation r is instead the fork (seed, r) of the checkpoint's stream. collect is
+//called from the worker threads with each finished realisation, sampled on the output grid, and the
+//time at which a stopping condition ended it.
+void runEnsemble(std::vector<std::string> patchNames, std::map<std::string, WithinPatchParameters> param_map, double max_time, double dt, int solver_type, int seed, int num_realisations, int n_threads, int equilibrium,
+                 std::vector<StoppingCondition> stop_conditions, std::string checkpoint, std::function<void(int, const std::map<std::string, std::vector<double>>&, double)> collect)
+{
+  std::vector<double> serialiser_times = makeSerialiserTimes(checkpointStartTime(checkpoint), max_time, dt);
+  
+  if (n_threads <= 0)
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  n_threads = std::min(n_threads, std::max(num_realisations, 1));
+  
+  std::atomic<int> next_realisation(0);
+  //Workers are not R's thread: they must not throw past std::thread, which would end the R session, or
+  //write to the console. The first exception stops every worker and is rethrown here once they are done,
+  //and each worker's diagnostics are printed after the join.
+  std::exception_ptr failure;
+  std::mutex failure_mutex;
+  std::vector<std::ostringstream> logs(n_threads);
+  
+  auto worker = [&](int w) {
+    MarkovChain chain;
+    chain.setLog(&logs[w]);
+    chain.setVerbose(false);
+    chain.setMaxTime(max_time);
+    try
+    {
+      ModelChickenFlu model = ModelChickenFlu(patchNames, param_map);
+      model.setupModel(chain);
+      chain.compile();
+      if (checkpoint.empty())
+        startAtEquilibrium(chain, model, equilibrium);
+      addStoppingConditions(chain, model, stop_conditions);
+      
+      for (int r = next_realisation++; r < num_realisations; r = next_realisation++)
+      {
+        SerialiserPredefinedTimesMemory serialiser(serialiser_times);
+        if (MarkovChain::isStochastic(solver_type))
+          serialiser.setShouldInterpolate(false);
+        chain.setSeed((uint32_t) seed, r);
+        startFromCheckpoint(chain, model, checkpoint, true, ((uint64_t)(uint32_t) seed << 32) | (uint32_t) r);
+        chain.setSerialiser(&serialiser);
+        chain.solve(solver_type);
+        collect(r, serialiser.getColumns(), chain.getStoppingTime());
+      }
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(failure_mutex);
+      if (!failure)
+        failure = std::current_exception();
+      next_realisation = num_realisations;
+    }
+    chain.cleanup();
+  };
+  
+  std::vector<std::thread> pool;
+  for (int i = 0; i < n_threads; i++)
+    pool.push_back(std::thread(worker, i));
+  for (std::thread &thread : pool)
+    thread.join();
+  for (std::ostringstream &log : logs)
+    Rcout << log.str();
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+// [[Rcpp::export(.chickens_model_ensemble)]]
+List chickens_model_ensemble(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int n_realisations, int n_threads, int equilibrium, List stop_conditions, RawVector checkpoint) {
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  
+  int num_realisations = std::max(n_realisations, 0);
+  std::vector<std::map<std::string, std::vector<double>>> realisations(num_realisations);
+  std::vector<double> stopping_times(num_realisations);
+  runEnsemble(patchNames, param_map, max_time, dt, solver_type, seed, num_realisations, n_threads, equilibrium, convertStoppingConditions(stop_conditions),
+              std::string(checkpoint.begin(), checkpoint.end()),
+              [&realisations, &stopping_times](int r, const std::map<std::string, std::vector<double>> &columns, double stopping_time) {
+                realisations[r] = columns;
+                stopping_times[r] = stopping_time;
+              });
+  
+  //Stack the realisations into long format.
+  std::map<std::string, std::vector<double>> columns;
+  std::vector<int> realisation_ids;
+  for (int r = 0; r < num_realisations; r++)
+  {
+    int rows = realisations[r].empty() ? 0 : realisations[r].begin()->second.size();
+    realisation_ids.insert(realisation_ids.end(), rows, r + 1);
+    for (auto &column : realisations[r])
+    {
+      std::vector<double> &target = columns[column.first];
+      target.insert(target.end(), column.second.begin(), column.second.end());
+    }
+    realisations[r].clear();
+  }
+  
+  List list(columns.size() + 1);
+  CharacterVector namevec;
+  namevec.push_back("realisation");
+  list[0] = realisation_ids;
+  int i = 1;
+  for (auto &column : columns)
+  {
+    namevec.push_back(column.first);
+    list[i] = column.second;
+    i++;
+  }
+  list.attr("names") = namevec;
+  list.attr("stopping_times") = stopping_times;
+  return (list);
+}
+
+// [[Rcpp::export(.chickens_model_ensemble_summary)]]
+List chickens_model_ensemble_summary(List parameters_patch, NumericMatrix betas, double max_time, double dt, int solver_type, int seed, int n_realisations, int n_threads, std::vector<double> probabilities, int equilibrium, List stop_conditions, RawVector checkpoint) {
+  //Folds realisations into running moments and quantile estimates in realisation order, whichever thread
+  //finishes first: both depend on the order values arrive in, so a seed gives the same summary with any
+  //number of threads. A realisation is held only until those before it have been folded in.
+  std::vector<std::string> patchNames = as<std::vector<std::string>>(rownames(betas));
+  std::map<std::string, WithinPatchParameters> param_map = convertPatchParameters(parameters_patch, betas, patchNames);
+  
+  std::string start(checkpoint.begin(), checkpoint.end());
+  EnsembleSummary summary(makeSerialiserTimes(checkpointStartTime(start), max_time, dt), probabilities);
+  std::mutex summary_mutex;
+  std::map<int, std::map<std::string, std::vector<double>>> pending;
+  int next_to_add = 0;
+  std::vector<double> stopping_times(std::max(n_realisations, 0));
+  runEnsemble(patchNames, param_map, max_time, dt, solver_type, seed, std::max(n_realisations, 0), n_threads, equilibrium, convertStoppingConditions(stop_conditions), start,
+              [&summary, &summary_mutex, &pending, &next_to_add, &stopping_times](int r, const std::map<std::string, std::vector<double>> &columns, double stopping_time) {
+                stopping_times[r] = stopping_time;
+                std::lock_guard<std::mutex> lock(summary_mutex);
+                pending[r] = columns;
+                for (auto it = pending.begin(); it != pending.end() && it->first == next_to_add; it = pending.erase(it))
+                {
+                  summary.add(it->second);
+                  next_to_add++;
+                }
+              });
+  
+  const std::vector<double> &times = summary.getTimes();
+  const std::vector<std::string> &states = summary.getColumns();
+  
+  auto table = [&](std::function<double(int, int)> statistic) {
+    List list(states.size() + 2);
+    CharacterVector namevec;
+    namevec.push_back("t");
+    namevec.push_back("n");
+    list[0] = times;
+    std::vector<int> counts(times.size());
+    for (int row = 0; row < times.size(); row++)
+      counts[row] = summary.getCount(row);
+    list[1] = counts;
+    for (int c = 0; c < states.size(); c++)
+    {
+      std::vector<double> values(times.size());
+      for (int row = 0; row < times.size(); row++)
+        values[row] = statistic(row, c);
+      namevec.push_back(states[c]);
+      list[c + 2] = values;
+    }
+    list.attr("names") = namevec;
+    return (list);
+  };
+  
+  List quantiles(probabilities.size());
+  CharacterVector quantile_names;
+  for (int q = 0; q < probabilities.size(); q++)
+  {
+    quantiles[q] = table([&summary, q](int row, int c) { return summary.getQuantile(row, c, q); });
+    std::ostringstream name;
+    name << probabilities[q];
+    quantile_names.push_back(name.str());
+  }
+  quantiles.attr("names") = quantile_names;
+  
+  return (List::create(Named("mean") = table([&summary](int row, int c) { return summary.getMean(row, c); }),
+                       Named("variance") = table([&summary](int row, int c) { return summary.getVariance(row, c); }),
+                       Named("quantiles") = quantiles,
+                       Named("stopping_times") = stopping_times));
+}
+
+//Passes a trajectory data frame to serialiser as a run's states would be: every column but "t" is a state.
+void serialiseTrajectory(DataFrame trajectory, Serialiser &serialiser)
+{
+  CharacterVector names = trajectory.names();
+  state_index schema;
+  std::vector<NumericVector> columns;
+  NumericVector times;
+  for (int c = 0; c < names.size(); c++)
+  {
+    std::string name = as<std::string>(names[c]);
+    if (name == "t")
+      times = trajectory[c];
+    else
+    {
+      schema[name] = columns.size();
+      columns.push_back(trajectory[c]);
+    }
+  }
+  if (times.size() == 0 && trajectory.nrows() > 0)
+    stop("The trajectory has no column t");
+  
+  serialiser.serialiseHeader(schema);
+  std::vector<double> row(columns.size());
+  for (int r = 0; r < times.size(); r++)
+  {
+    for (int c = 0; c < columns.size(); c++)
+      row[c] = columns[c][r];
+    serialiser.serialise(times[r], row.data());
+  }
+  serialiser.serialiseFinally(times.size() > 0 ? times[times.size() - 1] : 0, row.data());
+}
+
+//Every block of a BinaryTrajectoryReader or DeltaTrajectoryReader, as a data frame in the file's column order.
+template <typename Reader>
+List readTrajectory(Reader &reader)
+{
+  std::vector<std::vector<double>> columns(reader.getNames().size());
+  for (std::vector<double> &column : columns)
+    column.reserve(reader.getRowCount());
+  std::vector<std::vector<double>> block;
+  while (reader.readBlock(block))
+  {
+    for (size_t c = 0; c < columns.size(); c++)
+      columns[c].insert(columns[c].end(), block[c].begin(), block[c].end());
+  }
+  
+  List results(columns.size());
+  for (size_t c = 0; c < columns.size(); c++)
+    results[c] = NumericVector(columns[c].begin(), columns[c].end());
+  results.attr("names") = reader.getNames();
+  results.attr("class") = "data.frame";
+  results.attr("row.names") = IntegerVector::create(NA_INTEGER, columns.empty() ? 0 : -(int) columns[0].size());
+  return (results);
+}
+
+// [[Rcpp::export(.write_binary_trajectory)]]
+void write_binary_trajectory(DataFrame trajectory, std::string filename, bool single_precision) {
+  SerialiserBinary serialiser(filename, single_precision);
+  serialiseTrajectory(trajectory, serialiser);
+}
+
+// [[Rcpp::export(.read_binary_trajectory)]]
+List read_binary_trajectory(std::string filename) {
+  BinaryTrajectoryReader reader(filename);
+  if (!reader.good())
+    stop("Not a binary trajectory: " + filename);
+  return (readTrajectory(reader));
+}
+
+// [[Rcpp::export(.write_delta_trajectory)]]
+void write_delta_trajectory(DataFrame trajectory, std::string filename, bool compress) {
+  SerialiserDelta serialiser(filename, compress);
+  serialiseTrajectory(trajectory, serialiser);
+}
+
+// [[Rcpp::export(.read_delta_trajectory)]]
+List read_delta_trajectory(std::string filename) {
+  DeltaTrajectoryReader reader(filename);
+  if (!reader.good())
+    stop("Not a delta-encoded trajectory: " + filename);
+  return (readTrajectory(reader));
+}
+
+// [[Rcpp::export(.philox_block)]]
+NumericVector philox_block(NumericVector key, NumericVector counter) {
+  //One Philox4x32-10 output block, to check the generator against published known answers.
+  if (key.size() != 2 || counter.size() != 4)
+    stop("A Philox block needs two key words and four counter words");
+  PhiloxEngine::State state;
+  for (int i = 0; i < 2; i++)
+    state.key[i] = (uint32_t) key[i];
+  for (int i = 0; i < 4; i++)
+    state.counter[i] = (uint32_t) counter[i];
+  state.index = 4;
+  
+  PhiloxEngine engine;
+  engine.setState(state);
+  NumericVector block(4);
+  for (int i = 0; i < 4; i++)
+    block[i] = engine();
+  return (block);
+}